@@ -0,0 +1,695 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <wait.h>
+#include <fcntl.h>
+#include <sys/sysinfo.h>
+
+#include "general.h"
+#include "kernel.h"
+#include "list.h"
+#include "sum.h"
+
+/*
+ * Benchmarks of the hot paths, run by 'make bench':
+ *   kernels  - calcSums() throughput for every kernel and rule, in evaluations per second,
+ *              for the trapezoid rule also past BEST_FINENESS;
+ *   agreement - the distance in ulps of S and eps of every kernel from the scalar one
+ *               on the same segments, checked against KERNEL_ULP_TOLERANCE;
+ *   list     - the parent's segment bookkeeping on a synthetic refinement tree;
+ *   scaling  - wall time of ./integrate from 1 to maxWorkers workers for every engine;
+ *   summation - I and evaluations of ./integrate with plain and compensated sums
+ *               from 1 to maxWorkers workers, and whether I stays bitwise the same.
+ *   adapt    - evaluations of local and global adaptation for the same tolerance;
+ *   reuse    - evaluations of the nested rules with and without --reuse;
+ *   singular - the time ./integrate takes to give up on an integrand that is
+ *              infinite at a bound, which must stay below BENCH_SINGULAR_SECONDS.
+ * Results go to a JSON file, by default bench.json.
+ */
+
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_LIST_CHILDREN 4
+#define BENCH_LIST_BATCH 8
+#define BENCH_LIST_WIDTH 1e-4
+
+// Narrow enough for the trapezoid rule to sample it past BEST_FINENESS.
+#define BENCH_PRECISE_WIDTH 1e-7
+
+// Segments on which the kernels are compared; the last one is past BEST_FINENESS.
+static const double agreementSegments[][2] = {
+	{0.3, 1},
+	{0, 1},
+	{-2, 3.5},
+	{1e3, 1e3 + 1e-3},
+	{0.3, 0.3 + BENCH_PRECISE_WIDTH}
+};
+
+// Even on one CPU, several workers answer in a different order from run to run.
+#define BENCH_SUMMATION_WORKERS 3
+
+struct ScalingCase
+{
+	const char* name;
+	const char* function;	// passed as --function, NULL for the built-in integrand
+	const char* rule;
+	const char* left;
+	const char* right;
+	const char* maxDeviation;
+};
+
+static const struct ScalingCase scalingCases[] = {
+	{"cubic-trapezoid", NULL, "trapezoid", "0.3", "1", "1e-12"},
+	{"oscillating-trapezoid", "./libbenchfunc.so", "trapezoid", "0.01", "3", "1e-8"},
+	{"oscillating-gk15", "./libbenchfunc.so", "gk15", "0.01", "3", "1e-14"}
+};
+
+static const char* engines[] = {"process", "thread", "steal"};
+
+static const char* summations[] = {"plain", "neumaier"};
+
+// A batch of one job, so that ./integrate prints I with all 17 digits.
+static const struct ScalingCase summationCases[] = {
+	{"cubic-trapezoid", NULL, "trapezoid", "0.3", "1", "1e-12"},
+	{"oscillating-trapezoid", "./libbenchfunc.so", "trapezoid", "0.01", "3", "1e-10"}
+};
+
+static const char* adaptations[] = {"local", "global"};
+
+static const struct ScalingCase adaptCases[] = {
+	{"cubic-trapezoid", NULL, "trapezoid", "0.3", "1", "1e-12"},
+	{"oscillating-trapezoid", "./libbenchfunc.so", "trapezoid", "0.01", "3", "1e-10"},
+	{"oscillating-gk15", "./libbenchfunc.so", "gk15", "0.01", "3", "1e-13"}
+};
+
+static const struct ScalingCase reuseCases[] = {
+	{"oscillating-simpson", "./libbenchfunc.so", "simpson", "0.01", "3", "1e-10"},
+	{"oscillating-romberg", "./libbenchfunc.so", "romberg", "0.01", "3", "1e-12"}
+};
+
+// 1/sqrt(x) of the reference integrand is infinite at 0; no rule converges there without a transform.
+static const struct ScalingCase singularCase =
+	{"singular-trapezoid", "./libbenchfunc.so", "trapezoid", "0", "1", "1e-6"};
+
+#define BENCH_SINGULAR_WORKERS "4"
+#define BENCH_SINGULAR_SECONDS 10
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void benchKernels(FILE* out)
+{
+	static const enum KernelImpl kernels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+	static const char* ruleNames[] = {"trapezoid", "gk15", "simpson", "romberg"};
+	int first = true;
+
+	fprintf(out, "  \"kernels\": [\n");
+
+	for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if ((kernels[k] == KERNEL_AVX2 && !__builtin_cpu_supports("avx2"))
+			|| (kernels[k] == KERNEL_AVX512 && !__builtin_cpu_supports("avx512f")))
+			continue;
+#else
+		if (kernels[k] != KERNEL_SCALAR)
+			continue;
+#endif
+		selectKernel(kernels[k]);
+
+		for (enum QuadRule rule = RULE_TRAPEZOID; rule <= RULE_ROMBERG; rule++)
+		for (enum Summation summation = SUM_PLAIN; summation <= SUM_NEUMAIER; summation++)
+		for (int precise = false; precise <= true; precise++)
+		{
+			// Only the trapezoid rule goes through the SIMD kernels and adds up long sums.
+			if (rule != RULE_TRAPEZOID && (kernels[k] != KERNEL_SCALAR || summation != SUM_PLAIN))
+				continue;
+			// Its double-double sums past BEST_FINENESS do not depend on the summation.
+			if (precise && (rule != RULE_TRAPEZOID || summation != SUM_PLAIN))
+				continue;
+
+			selectRule(rule);
+			selectSummation(summation);
+
+			double S, eps, sink = 0;
+			long evaluations, total = 0, calls = 0;
+			enum ErrorCode error;
+			double start = now(), elapsed;
+
+			do
+			{
+				double right = precise ? 0.3 + BENCH_PRECISE_WIDTH + calls * 1e-15 : 1 + calls * 1e-9;
+				calcSums(0.3, right, N_SEGMENTS, &S, &eps, &evaluations, &error);
+				sink += S;
+				total += evaluations;
+				calls++;
+			}
+			while ((elapsed = now() - start) < BENCH_MIN_SECONDS);
+
+			fprintf(out, "%s    {\"kernel\": \"%s\", \"rule\": \"%s\", \"summation\": \"%s\", \"precise\": %s, \"calls\": %ld, "
+				"\"seconds\": %.6f, \"evaluations_per_second\": %.6g, \"checksum\": %.17g}",
+				first ? "" : ",\n", kernelName(), ruleNames[rule], summations[summation], precise ? "true" : "false", calls,
+				elapsed, total / elapsed, sink / calls);
+			first = false;
+		}
+	}
+
+	fprintf(out, "\n  ],\n");
+	selectKernel(KERNEL_AUTO);
+	selectRule(RULE_TRAPEZOID);
+	selectSummation(SUM_PLAIN);
+}
+
+/*
+ * Doubles as integers that are ordered like them, so that the difference of two
+ * is their distance in ulps.
+ */
+static int64_t orderedBits(double x)
+{
+	int64_t bits;
+
+	memcpy(&bits, &x, sizeof(bits));
+	return bits < 0 ? INT64_MIN - bits : bits;
+}
+
+static double ulpDistance(double a, double b)
+{
+	return fabs((double)orderedBits(a) - (double)orderedBits(b));
+}
+
+/*
+ * Runs every kernel on agreementSegments with the trapezoid rule, the only one
+ * they serve, and compares S and eps with those of the scalar kernel. Returns
+ * false if a kernel is further than KERNEL_ULP_TOLERANCE from it.
+ */
+static int benchAgreement(FILE* out)
+{
+	static const enum KernelImpl kernels[] = {KERNEL_AVX2, KERNEL_AVX512};
+	const int nSegments = sizeof(agreementSegments) / sizeof(agreementSegments[0]);
+	int first = true, agree = true;
+
+	selectRule(RULE_TRAPEZOID);
+	fprintf(out, "  \"agreement\": [\n");
+
+	for (enum Summation summation = SUM_PLAIN; summation <= SUM_NEUMAIER; summation++)
+	{
+		double S[nSegments], eps[nSegments];
+		long evaluations;
+		enum ErrorCode error;
+
+		selectSummation(summation);
+		selectKernel(KERNEL_SCALAR);
+		for (int i = 0; i < nSegments; i++)
+			calcSums(agreementSegments[i][0], agreementSegments[i][1], N_SEGMENTS, &S[i], &eps[i], &evaluations, &error);
+
+		for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_cpu_init();
+			if ((kernels[k] == KERNEL_AVX2 && !__builtin_cpu_supports("avx2"))
+				|| (kernels[k] == KERNEL_AVX512 && !__builtin_cpu_supports("avx512f")))
+				continue;
+#else
+			continue;
+#endif
+			selectKernel(kernels[k]);
+
+			double maxUlps = 0;
+			for (int i = 0; i < nSegments; i++)
+			{
+				double kernelS, kernelEps;
+
+				calcSums(agreementSegments[i][0], agreementSegments[i][1], N_SEGMENTS, &kernelS, &kernelEps, &evaluations, &error);
+				maxUlps = fmax(maxUlps, fmax(ulpDistance(kernelS, S[i]), ulpDistance(kernelEps, eps[i])));
+			}
+
+			int within = maxUlps <= KERNEL_ULP_TOLERANCE;
+			agree = agree && within;
+
+			fprintf(out, "%s    {\"kernel\": \"%s\", \"summation\": \"%s\", \"max_ulps\": %.0f, \"within_tolerance\": %s}",
+				first ? "" : ",\n", kernelName(), summations[summation], maxUlps, within ? "true" : "false");
+			first = false;
+
+			fprintf(stderr, "%s %s: %.0f ulps from scalar%s\n", kernelName(), summations[summation], maxUlps,
+				within ? "" : ", above KERNEL_ULP_TOLERANCE");
+		}
+	}
+
+	fprintf(out, "\n  ],\n");
+	selectKernel(KERNEL_AUTO);
+	selectSummation(SUM_PLAIN);
+	return agree;
+}
+
+/*
+ * Drives a SegmentList the way parentIntegrate() does, without children: segments
+ * go out in batches to BENCH_LIST_CHILDREN slots and come back in order. A segment
+ * is refused until it is narrower than a limit that tightens towards the left end,
+ * so the tree is deep there and shallow elsewhere.
+ */
+static void benchList(FILE* out)
+{
+	struct SegmentList segList = initList(0, 1);
+	struct UnstudiedSegment* seg;
+	long sent = 0, accepted = 0, refused = 0;
+	double I = 0;
+	double start = now();
+
+	while (!isEmpty(segList))
+	{
+		for (int child = 0; child < BENCH_LIST_CHILDREN; child++)
+		{
+			for (int i = 0; i < BENCH_LIST_BATCH && (seg = getSeg(segList, 0)) != NULL; i++)
+			{
+				setSegChild(seg, child + 1);
+				sent++;
+			}
+
+			while ((seg = getSeg(segList, child + 1)) != NULL)
+			{
+				double width = seg->right - seg->left;
+
+				if (width < BENCH_LIST_WIDTH * (0.01 + seg->left * seg->left))
+				{
+					seg->S = width;
+					I += removeSeg(seg);
+					accepted++;
+				}
+				else
+				{
+					seg->err = width * (1 - seg->left);
+					split(seg);
+					refused++;
+				}
+			}
+		}
+	}
+
+	double elapsed = now() - start;
+	long peakSegments, peakBytes;
+
+	destroyList(segList);
+	getSegmentPoolStats(&peakSegments, &peakBytes);
+
+	fprintf(out, "  \"list\": {\"sent\": %ld, \"accepted\": %ld, \"refused\": %ld, \"seconds\": %.6f, "
+		"\"segments_per_second\": %.6g, \"peak_segments\": %ld, \"peak_bytes\": %ld, \"checksum\": %.17g},\n",
+		sent, accepted, refused, elapsed, sent / elapsed, peakSegments, peakBytes, I);
+}
+
+/*
+ * Runs ./integrate with its progress output discarded. Returns the wall time,
+ * or a negative value if it did not print an answer.
+ */
+static double runIntegrate(const struct ScalingCase* c, const char* engine, int nWorkers)
+{
+	char engineArg[32], ruleArg[32], functionArg[256], workers[16];
+	char* argv[10];
+	int argc = 0;
+	int pipefd[2];
+	char answer[64];
+	ssize_t answerLen = 0, bytesRead;
+
+	snprintf(engineArg, sizeof(engineArg), "--engine=%s", engine);
+	snprintf(ruleArg, sizeof(ruleArg), "--rule=%s", c->rule);
+	snprintf(workers, sizeof(workers), "%d", nWorkers);
+
+	argv[argc++] = "./integrate";
+	argv[argc++] = engineArg;
+	argv[argc++] = ruleArg;
+	if (c->function != NULL)
+	{
+		snprintf(functionArg, sizeof(functionArg), "--function=%s", c->function);
+		argv[argc++] = functionArg;
+	}
+	argv[argc++] = (char*)c->left;
+	argv[argc++] = (char*)c->right;
+	argv[argc++] = workers;
+	argv[argc++] = (char*)c->maxDeviation;
+	argv[argc] = NULL;
+
+	if (pipe(pipefd) != 0)
+		return -1;
+
+	double start = now();
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(devNull, STDERR_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		execv(argv[0], argv);
+		exit(EXIT_FAILURE);
+	}
+
+	close(pipefd[1]);
+	while (answerLen < (ssize_t)sizeof(answer) - 1
+		&& (bytesRead = read(pipefd[0], answer + answerLen, sizeof(answer) - 1 - answerLen)) > 0)
+		answerLen += bytesRead;
+	close(pipefd[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || answerLen == 0)
+		return -1;
+
+	return elapsed;
+}
+
+/*
+ * Runs ./integrate --jobs on a single job with the given option, if any. Stores the
+ * I it printed, up to 63 characters, and the evaluations it reported; returns
+ * false on failure.
+ */
+static int runJob(const struct ScalingCase* c, const char* option, int nWorkers, char* I, long* evaluations)
+{
+	char jobsPath[] = "/tmp/integrate_bench_jobs_XXXXXX";
+	char errPath[] = "/tmp/integrate_bench_err_XXXXXX";
+	char ruleArg[32], jobsArg[64], functionArg[256], workers[16], line[256];
+	char* argv[8];
+	int argc = 0;
+	int ok = false;
+
+	int jobsFd = mkstemp(jobsPath);
+	int errFd = mkstemp(errPath);
+	if (jobsFd < 0 || errFd < 0)
+		return false;
+
+	FILE* jobs = fdopen(jobsFd, "w");
+	fprintf(jobs, "%s %s %s\n", c->left, c->right, c->maxDeviation);
+	fclose(jobs);
+
+	snprintf(ruleArg, sizeof(ruleArg), "--rule=%s", c->rule);
+	snprintf(jobsArg, sizeof(jobsArg), "--jobs=%s", jobsPath);
+	snprintf(workers, sizeof(workers), "%d", nWorkers);
+
+	argv[argc++] = "./integrate";
+	if (option != NULL)
+		argv[argc++] = (char*)option;
+	argv[argc++] = ruleArg;
+	if (c->function != NULL)
+	{
+		snprintf(functionArg, sizeof(functionArg), "--function=%s", c->function);
+		argv[argc++] = functionArg;
+	}
+	argv[argc++] = jobsArg;
+	argv[argc++] = workers;
+	argv[argc] = NULL;
+
+	int pipefd[2];
+	if (pipe(pipefd) != 0)
+		return false;
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(errFd, STDERR_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		execv(argv[0], argv);
+		exit(EXIT_FAILURE);
+	}
+	close(pipefd[1]);
+
+	// "line left right maxDeviation I error status"
+	FILE* answers = fdopen(pipefd[0], "r");
+	if (fgets(line, sizeof(line), answers) != NULL
+		&& sscanf(line, "%*s %*s %*s %*s %63s", I) == 1 && strstr(line, " ok") != NULL)
+		ok = true;
+	fclose(answers);
+	waitpid(pid, NULL, 0);
+
+	FILE* err = fdopen(errFd, "r");
+	rewind(err);
+	*evaluations = 0;
+	while (fgets(line, sizeof(line), err) != NULL)
+		sscanf(line, "Function evaluations: %ld", evaluations);
+	fclose(err);
+
+	unlink(jobsPath);
+	unlink(errPath);
+
+	return ok && *evaluations > 0;
+}
+
+static void benchSummation(FILE* out, int maxWorkers)
+{
+	int first = true;
+
+	fprintf(out, "  \"summation\": [\n");
+
+	for (unsigned c = 0; c < sizeof(summationCases) / sizeof(summationCases[0]); c++)
+		for (unsigned s = 0; s < sizeof(summations) / sizeof(summations[0]); s++)
+		{
+			char option[32], firstI[64] = "", I[64];
+			long evaluations;
+			int same = true;
+
+			snprintf(option, sizeof(option), "--sum=%s", summations[s]);
+			for (int n = 1; n <= maxWorkers || n <= BENCH_SUMMATION_WORKERS; n++)
+			{
+				int ok = runJob(&summationCases[c], option, n, I, &evaluations);
+				if (!ok)
+					strcpy(I, "null");
+				if (n == 1)
+					strcpy(firstI, I);
+				same = same && ok && strcmp(I, firstI) == 0;
+
+				fprintf(out, "%s    {\"case\": \"%s\", \"summation\": \"%s\", \"workers\": %d, \"ok\": %s, "
+					"\"I\": %s, \"evaluations\": %ld, \"same_as_one_worker\": %s}",
+					first ? "" : ",\n", summationCases[c].name, summations[s], n, ok ? "true" : "false",
+					I, evaluations, same ? "true" : "false");
+				first = false;
+
+				fprintf(stderr, "%s %s %d: %s, %ld evaluations\n", summationCases[c].name, summations[s], n, I, evaluations);
+			}
+		}
+
+	fprintf(out, "\n  ],\n");
+}
+
+/*
+ * Evaluations of local and global adaptation for the same tolerance, and the
+ * share of them that global adaptation saves.
+ */
+static void benchAdapt(FILE* out)
+{
+	int first = true;
+
+	fprintf(out, "  \"adapt\": [\n");
+
+	for (unsigned c = 0; c < sizeof(adaptCases) / sizeof(adaptCases[0]); c++)
+	{
+		long local = 0;
+
+		for (unsigned a = 0; a < sizeof(adaptations) / sizeof(adaptations[0]); a++)
+		{
+			char option[32], I[64];
+			long evaluations;
+
+			snprintf(option, sizeof(option), "--adapt=%s", adaptations[a]);
+			int ok = runJob(&adaptCases[c], option, 1, I, &evaluations);
+			if (!ok)
+				strcpy(I, "null");
+			if (a == 0)
+				local = ok ? evaluations : 0;
+
+			fprintf(out, "%s    {\"case\": \"%s\", \"adapt\": \"%s\", \"ok\": %s, "
+				"\"I\": %s, \"evaluations\": %ld, \"saved\": %.3f}",
+				first ? "" : ",\n", adaptCases[c].name, adaptations[a], ok ? "true" : "false",
+				I, evaluations, ok && local > 0 ? 1 - (double)evaluations / local : 0);
+			first = false;
+
+			fprintf(stderr, "%s %s: %s, %ld evaluations\n", adaptCases[c].name, adaptations[a], I, evaluations);
+		}
+	}
+
+	fprintf(out, "\n  ],\n");
+}
+
+/*
+ * Evaluations of the nested rules with and without --reuse.
+ */
+static void benchReuse(FILE* out)
+{
+	int first = true;
+
+	fprintf(out, "  \"reuse\": [\n");
+
+	for (unsigned c = 0; c < sizeof(reuseCases) / sizeof(reuseCases[0]); c++)
+	{
+		long fresh = 0;
+
+		for (int reuse = false; reuse <= true; reuse++)
+		{
+			char I[64];
+			long evaluations;
+
+			int ok = runJob(&reuseCases[c], reuse ? "--reuse" : NULL, 1, I, &evaluations);
+			if (!ok)
+				strcpy(I, "null");
+			if (!reuse)
+				fresh = ok ? evaluations : 0;
+
+			fprintf(out, "%s    {\"case\": \"%s\", \"reuse\": %s, \"ok\": %s, "
+				"\"I\": %s, \"evaluations\": %ld, \"saved\": %.3f}",
+				first ? "" : ",\n", reuseCases[c].name, reuse ? "true" : "false", ok ? "true" : "false",
+				I, evaluations, ok && fresh > 0 ? 1 - (double)evaluations / fresh : 0);
+			first = false;
+
+			fprintf(stderr, "%s%s: %s, %ld evaluations\n", reuseCases[c].name, reuse ? " reuse" : "", I, evaluations);
+		}
+	}
+
+	fprintf(out, "\n  ],\n");
+}
+
+/*
+ * Runs ./integrate on singularCase, killed after BENCH_SINGULAR_SECONDS. Returns
+ * false if it was killed or printed an answer instead of giving up.
+ */
+static int benchSingular(FILE* out)
+{
+	char functionArg[256], ruleArg[32];
+	char* argv[] = {"./integrate", ruleArg, functionArg, (char*)singularCase.left, (char*)singularCase.right,
+		BENCH_SINGULAR_WORKERS, (char*)singularCase.maxDeviation, NULL};
+	int pipefd[2], status = 0;
+	char answer[64];
+	ssize_t answerLen = 0, bytesRead;
+
+	snprintf(functionArg, sizeof(functionArg), "--function=%s", singularCase.function);
+	snprintf(ruleArg, sizeof(ruleArg), "--rule=%s", singularCase.rule);
+
+	if (pipe(pipefd) != 0)
+		return false;
+
+	double start = now();
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(devNull, STDERR_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		// Survives the exec; the children it forks are killed with it, their pipes closing.
+		alarm(BENCH_SINGULAR_SECONDS);
+		execv(argv[0], argv);
+		exit(EXIT_FAILURE);
+	}
+
+	close(pipefd[1]);
+	while (answerLen < (ssize_t)sizeof(answer) - 1
+		&& (bytesRead = read(pipefd[0], answer + answerLen, sizeof(answer) - 1 - answerLen)) > 0)
+		answerLen += bytesRead;
+	close(pipefd[0]);
+
+	if (pid > 0)
+		waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+
+	int gaveUp = pid > 0 && WIFEXITED(status) && answerLen == 0;
+
+	fprintf(out, "  \"singular\": {\"case\": \"%s\", \"seconds\": %.6f, \"gave_up\": %s},\n",
+		singularCase.name, elapsed, gaveUp ? "true" : "false");
+	fprintf(stderr, "%s: %.3f s, %s\n", singularCase.name, elapsed,
+		gaveUp ? "gave up" : "did not give up in time");
+
+	return gaveUp;
+}
+
+static void benchScaling(FILE* out, int maxWorkers)
+{
+	int first = true;
+
+	fprintf(out, "  \"scaling\": [\n");
+
+	for (unsigned c = 0; c < sizeof(scalingCases) / sizeof(scalingCases[0]); c++)
+		for (unsigned e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+		{
+			double base = 0;
+
+			for (int n = 1; n <= maxWorkers; n++)
+			{
+				double elapsed = runIntegrate(&scalingCases[c], engines[e], n);
+				if (n == 1)
+					base = elapsed;
+
+				fprintf(out, "%s    {\"case\": \"%s\", \"engine\": \"%s\", \"workers\": %d, \"ok\": %s, "
+					"\"seconds\": %.6f, \"speedup\": %.3f}",
+					first ? "" : ",\n", scalingCases[c].name, engines[e], n, elapsed < 0 ? "false" : "true",
+					elapsed, elapsed > 0 && base > 0 ? base / elapsed : 0);
+				first = false;
+
+				fprintf(stderr, "%s %s %d: %.3f s\n", scalingCases[c].name, engines[e], n, elapsed);
+			}
+		}
+
+	fprintf(out, "\n  ]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = argc > 1 ? argv[1] : "bench.json";
+	int maxWorkers = argc > 2 ? atoi(argv[2]) : get_nprocs();
+
+	if (maxWorkers < 1)
+		maxWorkers = 1;
+
+	FILE* out = fopen(path, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Failed to open %s.\n", path);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "{\n  \"cpus\": %d,\n", get_nprocs());
+
+	fprintf(stderr, "Kernels...\n");
+	benchKernels(out);
+	fprintf(stderr, "Kernel agreement...\n");
+	int agree = benchAgreement(out);
+	fprintf(stderr, "Segment list...\n");
+	benchList(out);
+	fprintf(stderr, "Summation up to %d workers...\n", maxWorkers);
+	benchSummation(out, maxWorkers);
+	fprintf(stderr, "Adaptation...\n");
+	benchAdapt(out);
+	fprintf(stderr, "Reuse of evaluations...\n");
+	benchReuse(out);
+	fprintf(stderr, "Singular integrand...\n");
+	int gaveUp = benchSingular(out);
+	fprintf(stderr, "Scaling up to %d workers...\n", maxWorkers);
+	benchScaling(out, maxWorkers);
+
+	fprintf(out, "}\n");
+	fclose(out);
+
+	fprintf(stderr, "Results written to %s\n", path);
+	if (!agree)
+	{
+		fprintf(stderr, "The kernels disagree by more than %d ulps.\n", KERNEL_ULP_TOLERANCE);
+		return EXIT_FAILURE;
+	}
+	if (!gaveUp)
+	{
+		fprintf(stderr, "./integrate did not give up on a singular integrand within %d s.\n", BENCH_SINGULAR_SECONDS);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
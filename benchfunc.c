@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include <math.h>
+
+/*
+ * Reference integrand of 'make bench': oscillating, with a steep end near 0.
+ */
+
+double func(double x)
+{
+	return exp(x) * sin(10 * x) + 1 / sqrt(x);
+}
+
+void func_v(const double* x, double* y, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		y[i] = exp(x[i]) * sin(10 * x[i]) + 1 / sqrt(x[i]);
+}
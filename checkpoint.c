@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "checkpoint.h"
+#include "kernel.h"
+#include "ui.h"
+
+#define CHECKPOINT_MAGIC "INTGCKPT"
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+
+/*
+ * File layout: the header, then nSegments segments, then nContributions
+ * accepted segments. All are written as they are in memory; byteOrder refuses
+ * files of a machine with another one.
+ */
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	char rule[CHECKPOINT_RULE_MAX];
+	uint32_t summation;
+	double samples[INTEGRAND_SAMPLES];	// sampleIntegrand()
+
+	double left;
+	double right;
+	double maxDeviation;
+
+	double I;
+	double sum;				// --sum=neumaier: the running sum of the job and its compensation
+	double compensation;
+	double errorSpent;
+	double resolvedWidth;
+	int64_t completed;
+	int64_t evaluations;
+	int64_t nSegments;
+	int64_t nContributions;
+} __attribute__((packed));
+
+struct CheckpointSegment
+{
+	double left;
+	double right;
+	double err;
+	int32_t nSegments;
+} __attribute__((packed));
+
+// An accepted segment that completeJob() adds in the order of left.
+struct CheckpointContribution
+{
+	double left;
+	double S;
+} __attribute__((packed));
+
+static char* checkpointPath = NULL;
+static char* tmpPath = NULL;
+static long lastSave;
+static double samples[INTEGRAND_SAMPLES];
+static volatile sig_atomic_t interrupted = false;
+
+// The snapshot belongs to the writer from the moment it is queued until it is written.
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int queued = false;
+static int writing = false;
+static int stopping = false;
+
+static struct CheckpointHeader header;
+static struct CheckpointSegment* segs = NULL;
+static long segsSize = 0;
+static struct CheckpointContribution* contributions = NULL;
+static long contributionsSize = 0;
+
+// What --resume read, until checkpointRestore() puts it into the list.
+static int resuming = false;
+
+static void onSignal(int sig)
+{
+	(void)sig;
+	interrupted = true;
+}
+
+static void reserve(long nSegments)
+{
+	if (nSegments <= segsSize)
+		return;
+
+	free(segs);
+	segsSize = 2 * nSegments;
+	segs = malloc(segsSize * sizeof(struct CheckpointSegment));
+	if (segs == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for a checkpoint.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void reserveContributions(long n)
+{
+	if (n <= contributionsSize)
+		return;
+
+	free(contributions);
+	contributionsSize = 2 * n;
+	contributions = malloc(contributionsSize * sizeof(struct CheckpointContribution));
+	if (contributions == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for a checkpoint.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int writeFile()
+{
+	FILE* out = fopen(tmpPath, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Failed to write checkpoint %s.\n", tmpPath);
+		return false;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(segs, sizeof(struct CheckpointSegment), header.nSegments, out) == (size_t)header.nSegments
+		&& fwrite(contributions, sizeof(struct CheckpointContribution), header.nContributions, out)
+			== (size_t)header.nContributions
+		&& fflush(out) == 0
+		&& fsync(fileno(out)) == 0;
+	ok = fclose(out) == 0 && ok;
+
+	if (!ok || rename(tmpPath, checkpointPath) != 0)
+	{
+		fprintf(stderr, "Failed to write checkpoint %s.\n", checkpointPath);
+		unlink(tmpPath);
+		return false;
+	}
+
+	return true;
+}
+
+static void* writerThread(void* arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&lock);
+
+	while (true)
+	{
+		while (!queued && !stopping)
+			pthread_cond_wait(&changed, &lock);
+		if (!queued)
+			break;
+
+		queued = false;
+		writing = true;
+		pthread_mutex_unlock(&lock);
+
+		writeFile();
+
+		pthread_mutex_lock(&lock);
+		writing = false;
+		pthread_cond_broadcast(&changed);
+	}
+
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static int readFile(const char* path, double left, double right, double maxDeviation)
+{
+	FILE* in = fopen(path, "rb");
+	if (in == NULL)
+	{
+		fprintf(stderr, "Failed to open checkpoint %s.\n", path);
+		return false;
+	}
+
+	int ok = fread(&header, sizeof(header), 1, in) == 1
+		&& memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == CHECKPOINT_VERSION
+		&& header.byteOrder == CHECKPOINT_BYTE_ORDER
+		&& header.nSegments >= 0
+		&& header.nContributions >= 0;
+
+	if (ok)
+	{
+		reserve(header.nSegments);
+		reserveContributions(header.nContributions);
+		ok = fread(segs, sizeof(struct CheckpointSegment), header.nSegments, in) == (size_t)header.nSegments
+			&& fread(contributions, sizeof(struct CheckpointContribution), header.nContributions, in)
+				== (size_t)header.nContributions;
+	}
+	fclose(in);
+
+	if (!ok)
+	{
+		fprintf(stderr, "%s is not a checkpoint of this version of integrate.\n", path);
+		return false;
+	}
+
+	if (header.left != left || header.right != right || header.maxDeviation != maxDeviation
+		|| strncmp(header.rule, ruleName(), CHECKPOINT_RULE_MAX) != 0)
+	{
+		fprintf(stderr, "%s is a checkpoint of %.17g %.17g %g with rule %.*s; resume with the same arguments.\n",
+			path, header.left, header.right, header.maxDeviation, CHECKPOINT_RULE_MAX, header.rule);
+		return false;
+	}
+
+	if (header.summation != (uint32_t)compensatedSummation())
+	{
+		fprintf(stderr, "%s is a checkpoint of %s sums; resume with the same --sum.\n",
+			path, header.summation ? "compensated" : "plain");
+		return false;
+	}
+
+	double saved[INTEGRAND_SAMPLES];
+	memcpy(saved, header.samples, sizeof(saved));
+	if (!sameIntegrand(saved, samples))
+	{
+		fprintf(stderr, "%s is a checkpoint of another integrand; resume with the same --function.\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+int checkpointOpen(const char* path, int resume, double left, double right, double maxDeviation)
+{
+	sampleIntegrand(samples);
+
+	if (resume && !readFile(path, left, right, maxDeviation))
+		return false;
+
+	checkpointPath = strdup(path);
+	tmpPath = malloc(strlen(path) + sizeof(".tmp"));
+	if (checkpointPath == NULL || tmpPath == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmpPath, "%s.tmp", path);
+
+	resuming = resume;
+	lastSave = nowMicros();
+
+	// A second signal ends the program at once. Reads of thread children restart; select() in the parent does not.
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onSignal;
+	action.sa_flags = SA_RESETHAND | SA_RESTART;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (pthread_create(&writer, NULL, writerThread, NULL) != 0)
+	{
+		fprintf(stderr, "Failed to create new thread.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return true;
+}
+
+int checkpointInterrupted()
+{
+	return interrupted;
+}
+
+/*
+ * Replaces the root segment that startJobs() gave the job with the segments
+ * and sums of the checkpoint.
+ */
+void checkpointRestore(struct SegmentList segList, struct Job* job, struct StatsSample* progress)
+{
+	if (!resuming)
+		return;
+
+	removeJobSegs(segList, 0);
+	for (long i = 0; i < header.nSegments; i++)
+		restoreSeg(segList, segs[i].left, segs[i].right, segs[i].err, segs[i].nSegments, 0);
+
+	job->pending = header.nSegments;
+	job->I = header.I;
+	job->sum = (struct CompensatedSum){header.sum, header.compensation};
+	for (long i = 0; i < header.nContributions; i++)
+	{
+		double left = contributions[i].left;
+		contributionsAdd(&job->accepted, &left, 1, contributions[i].S);
+	}
+	job->errorSpent = header.errorSpent;
+
+	progress->I += header.I;
+	progress->errorSpent += header.errorSpent;
+	progress->resolvedWidth += header.resolvedWidth;
+	progress->completed += header.completed;
+	progress->evaluations += header.evaluations;
+
+	fprintf(stderr, "Resumed from %s: %ld segments left, %ld evaluations done.\n",
+		checkpointPath, (long)header.nSegments, (long)header.evaluations);
+	resuming = false;
+}
+
+/*
+ * Copies the unfinished segments, both free and in flight, for the writer. Does
+ * nothing before CHECKPOINT_PERIOD_MS has passed or while the last checkpoint
+ * is still being written, unless final, which waits for the writer instead.
+ */
+void checkpointSave(struct SegmentList segList, struct Job* job, struct StatsSample* progress, int final)
+{
+	if (checkpointPath == NULL)
+		return;
+
+	long now = nowMicros();
+	if (!final && now - lastSave < CHECKPOINT_PERIOD_MS * 1000L)
+		return;
+
+	pthread_mutex_lock(&lock);
+	while (final && (queued || writing))
+		pthread_cond_wait(&changed, &lock);
+	int busy = queued || writing;
+	pthread_mutex_unlock(&lock);
+
+	if (busy)
+		return;
+
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.byteOrder = CHECKPOINT_BYTE_ORDER;
+	strncpy(header.rule, ruleName(), CHECKPOINT_RULE_MAX);
+	header.summation = compensatedSummation();
+	memcpy(header.samples, samples, sizeof(header.samples));
+	header.left = job->left;
+	header.right = job->right;
+	header.maxDeviation = job->maxDeviation;
+	header.I = job->I;
+	header.sum = job->sum.sum;
+	header.compensation = job->sum.c;
+	header.errorSpent = job->errorSpent;
+	header.resolvedWidth = progress->resolvedWidth;
+	header.completed = progress->completed;
+	header.evaluations = progress->evaluations;
+
+	reserve(listLen(segList));
+	header.nSegments = 0;
+	for (struct UnstudiedSegment* seg = segList.head->next; seg != segList.head; seg = seg->next)
+		segs[header.nSegments++] = (struct CheckpointSegment){seg->left, seg->right, seg->err, seg->nSegments};
+
+	// A checkpoint is of a 1-D integral, so every item is left and S.
+	reserveContributions(job->accepted.n);
+	header.nContributions = job->accepted.n;
+	for (long i = 0; i < job->accepted.n; i++)
+		contributions[i] = (struct CheckpointContribution){job->accepted.items[2 * i], job->accepted.items[2 * i + 1]};
+
+	lastSave = now;
+
+	pthread_mutex_lock(&lock);
+	queued = true;
+	pthread_cond_signal(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Waits for the last checkpoint to be written. A complete integral needs none.
+ */
+void checkpointClose(int complete)
+{
+	if (checkpointPath == NULL)
+		return;
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&changed);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, NULL);
+
+	if (complete)
+		unlink(checkpointPath);
+
+	free(checkpointPath);
+	free(tmpPath);
+	free(segs);
+	free(contributions);
+	checkpointPath = NULL;
+	segs = NULL;
+	segsSize = 0;
+	contributions = NULL;
+	contributionsSize = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "general.h"
+#include "list.h"
+#include "jobs.h"
+#include "stats.h"
+
+#define CHECKPOINT_PERIOD_MS 10000
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_RULE_MAX 16
+
+/*
+ * Checkpoints of a single integral: the unfinished segments, the part of I
+ * already accepted, with --sum=neumaier also its terms, and the counters. A writer thread saves them every
+ * CHECKPOINT_PERIOD_MS to path.tmp and renames that over path, so the file
+ * is always complete. SIGINT and SIGTERM write a last one and stop the run.
+ * All calls do nothing until checkpointOpen() succeeds.
+ */
+int checkpointOpen(const char* path, int resume, double left, double right, double maxDeviation);
+int checkpointInterrupted();
+void checkpointRestore(struct SegmentList segList, struct Job* job, struct StatsSample* progress);
+void checkpointSave(struct SegmentList segList, struct Job* job, struct StatsSample* progress, int final);
+void checkpointClose(int complete);
+
+#endif
@@ -1,99 +1,263 @@
-#define _POSIX_C_SOURCE 2
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <stdlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
 #include "cpuconf.h"
 
-int maxCPU;
-int maxCore;
-int* coreForCPU;
-int* CPUOrder;
-int nCPUs;
+/*
+ * Topology of the CPUs this process may run on, read from sysfs. Children are
+ * placed in CPUOrder: one hardware thread of every physical core before any
+ * SMT sibling, and either spread over the NUMA nodes or packed node by node.
+ */
 
-void parseCoresForCPU()
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+// mbind() from <numaif.h>, without linking libnuma.
+#define MPOL_PREFERRED 1
+#define MPOL_MF_MOVE (1 << 1)
+
+struct CPUInfo
+{
+	int cpu;
+	int core;
+	int package;
+	int node;
+	int llc;	// id of the last level cache
+	int thread;	// 0 for the first hardware thread of a core, 1 for its sibling and so on
+	int rank;	// position among the CPUs of its node with the same thread
+};
+
+static enum Placement placement = PLACEMENT_SCATTER;
+
+static struct CPUInfo* CPUOrder;
+static int nCPUs;
+static int nNodes;
+
+void selectPlacement(enum Placement policy)
 {
-	FILE* info = popen("lscpu -p | tail -n-4", "r");
+	placement = policy;
+}
 
-	int cpu, core, socket, node, l1d, l1i, l2;
+static int readInt(const char* path, int fallback)
+{
+	FILE* file = fopen(path, "r");
+	int value;
 
-	maxCPU = -1;
-	maxCore = -1;
-	coreForCPU = NULL;
+	if (file == NULL)
+		return fallback;
+	if (fscanf(file, "%d", &value) != 1)
+		value = fallback;
 
-	while(fscanf(info, "%d,%d,%d,%d,,%d,%d,%d", &cpu, &core, &socket, &node, &l1d, &l1i, &l2) > 0) 
+	fclose(file);
+	return value;
+}
+
+/*
+ * Reads a sysfs CPU list such as "0-3,8-11" and gives every CPU in it the node.
+ */
+static void assignNode(const char* path, int node)
+{
+	FILE* file = fopen(path, "r");
+	int first, last;
+
+	if (file == NULL)
+		return;
+
+	while (fscanf(file, "%d", &first) == 1)
 	{
-		if (cpu > maxCPU)
+		if (fscanf(file, "-%d", &last) != 1)
+			last = first;
+
+		for (int i = 0; i < nCPUs; i++)
+			if (CPUOrder[i].cpu >= first && CPUOrder[i].cpu <= last)
+				CPUOrder[i].node = node;
+
+		if (fgetc(file) != ',')
+			break;
+	}
+
+	fclose(file);
+}
+
+static void readNodes()
+{
+	DIR* dir = opendir(SYSFS_NODE);
+	struct dirent* entry;
+	char path[256];
+	int node;
+
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL)
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
 		{
-			coreForCPU = realloc(coreForCPU, sizeof(int) * (cpu + 1));
-			for (int i = maxCPU + 1; i <= cpu; i++)
-				coreForCPU[i] = -1;
+			snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+			assignNode(path, node);
+		}
 
-			maxCPU = cpu;
+	closedir(dir);
+}
+
+/*
+ * The cache of the highest level that reports an id; the package if none does.
+ */
+static int readLastLevelCache(int cpu, int package)
+{
+	char path[256];
+	int llc = package, bestLevel = 0;
+
+	for (int index = 0; ; index++)
+	{
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, index);
+		int level = readInt(path, -1);
+		if (level < 0)
+			break;
+
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/id", cpu, index);
+		int id = readInt(path, -1);
+		if (id >= 0 && level > bestLevel)
+		{
+			bestLevel = level;
+			llc = package * 0x10000 + id;
 		}
-		
-		if (core > maxCore)
-			maxCore = core;
+	}
+
+	return llc;
+}
 
-		coreForCPU[cpu] = core;
+static void readCPUs()
+{
+	cpu_set_t allowed;
+	char path[256];
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		CPU_ZERO(&allowed);
+		CPU_SET(0, &allowed);
 	}
 
-	pclose(info);
+	CPUOrder = malloc(CPU_COUNT(&allowed) * sizeof(struct CPUInfo));
+	if (CPUOrder == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
 
 	nCPUs = 0;
-	for (int i = 0; i <= maxCPU; i++)
-		if (coreForCPU[i] != -1)
-			nCPUs++;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+
+		struct CPUInfo* info = &CPUOrder[nCPUs++];
+		info->cpu = cpu;
+
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+		info->core = readInt(path, cpu);
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+		info->package = readInt(path, 0);
+
+		info->llc = readLastLevelCache(cpu, info->package);
+		info->node = 0;
+	}
 
-	CPUOrder = malloc(nCPUs * sizeof(int));
+	readNodes();
 }
 
-int findCPUForNextCore(int core)
+static int compareTopology(const struct CPUInfo* a, const struct CPUInfo* b)
 {
-	int cpu = -1;
-	for (int i = 0; i <= maxCPU; i++)
-	{
-		if (coreForCPU[i] > core && (cpu == -1 || coreForCPU[i] < coreForCPU[cpu]))
-			cpu = i;
-	}
+	if (a->package != b->package)
+		return a->package - b->package;
+	if (a->llc != b->llc)
+		return a->llc - b->llc;
+	if (a->core != b->core)
+		return a->core - b->core;
+	return a->cpu - b->cpu;
+}
 
-	if (cpu == -1)
-		return findCPUForNextCore(-1);
+static int compareSiblings(const void* a, const void* b)
+{
+	return compareTopology(a, b);
+}
+
+static int compareRanks(const void* a, const void* b)
+{
+	const struct CPUInfo* x = a;
+	const struct CPUInfo* y = b;
 
-	return cpu;
+	if (x->node != y->node)
+		return x->node - y->node;
+	if (x->thread != y->thread)
+		return x->thread - y->thread;
+	return compareTopology(x, y);
 }
 
-void buildCPUOrder()
+/*
+ * compact: node by node, all physical cores of a node before their siblings.
+ * scatter: round robin over the nodes, all physical cores before any sibling.
+ */
+static int compareOrder(const void* a, const void* b)
 {
-	int cpu;
-	int core = -1;
-	for (int i = 0; i < nCPUs; i++)
+	const struct CPUInfo* x = a;
+	const struct CPUInfo* y = b;
+
+	if (placement == PLACEMENT_COMPACT)
+		return compareRanks(a, b);
+
+	if (x->thread != y->thread)
+		return x->thread - y->thread;
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	return x->node - y->node;
+}
+
+static void buildCPUOrder()
+{
+	// Siblings of a core end up next to each other and are numbered in turn.
+	qsort(CPUOrder, nCPUs, sizeof(struct CPUInfo), compareSiblings);
+	CPUOrder[0].thread = 0;
+	for (int i = 1; i < nCPUs; i++)
 	{
-		cpu = findCPUForNextCore(core);
-		core = coreForCPU[cpu];
-		coreForCPU[cpu] = -1;
-		CPUOrder[i] = cpu;
+		struct CPUInfo* prev = &CPUOrder[i - 1];
+		int sibling = prev->package == CPUOrder[i].package && prev->core == CPUOrder[i].core;
+
+		CPUOrder[i].thread = sibling ? prev->thread + 1 : 0;
+	}
+
+	qsort(CPUOrder, nCPUs, sizeof(struct CPUInfo), compareRanks);
+	CPUOrder[0].rank = 0;
+	nNodes = 1;
+	for (int i = 1; i < nCPUs; i++)
+	{
+		struct CPUInfo* prev = &CPUOrder[i - 1];
+		int sameGroup = prev->node == CPUOrder[i].node && prev->thread == CPUOrder[i].thread;
+
+		CPUOrder[i].rank = sameGroup ? prev->rank + 1 : 0;
+		if (prev->node != CPUOrder[i].node)
+			nNodes++;
 	}
 
-	free(coreForCPU);
+	qsort(CPUOrder, nCPUs, sizeof(struct CPUInfo), compareOrder);
 }
 
 void initCPUData()
 {
-	parseCoresForCPU();
-	for (int i = 0; i <= maxCPU; i++)
-		fprintf(stderr, "%d ", coreForCPU[i]);
-	fprintf(stderr, "\n");
+	// Not every sysfs entry exists everywhere; keep errno clean for the callers.
+	int savedErrno = errno;
 
+	readCPUs();
 	buildCPUOrder();
-	for (int i = 0; i < nCPUs; i++)
-		fprintf(stderr, "%d ", CPUOrder[i]);
-	fprintf(stderr, "\n");
+
+	errno = savedErrno;
 }
 
 void destroyCPUData()
@@ -103,5 +267,47 @@ void destroyCPUData()
 
 int getCPUForChild(int child)
 {
-	return CPUOrder[child % nCPUs];
+	return CPUOrder[child % nCPUs].cpu;
+}
+
+int getNodeForChild(int child)
+{
+	return CPUOrder[child % nCPUs].node;
+}
+
+/*
+ * Pins the calling thread, which is the whole child when it is a process.
+ */
+void attachChildToCPU(int child)
+{
+	int cpu = getCPUForChild(child);
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int code = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (code != 0)
+		fprintf(stderr, "Failed to attach child %d to CPU %d: %s (%d)\n", child, cpu, strerror(code), code);
+}
+
+/*
+ * Asks the kernel to keep the whole pages of [addr, addr + size) on the node of
+ * the child. Memory a child allocates after attachChildToCPU() is local anyway;
+ * this is for buffers the parent maps for it. Best effort: does nothing on a
+ * single node or when mbind() is not available.
+ */
+void bindToChildNode(void* addr, size_t size, int child)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long)addr + page - 1) & ~(page - 1);
+	unsigned long end = ((unsigned long)addr + size) & ~(page - 1);
+	int node = getNodeForChild(child);
+	unsigned long nodeMask;
+
+	if (nNodes < 2 || end <= start || node >= (int)(8 * sizeof(nodeMask)))
+		return;
+
+	nodeMask = 1UL << node;
+
+	syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &nodeMask, 8 * sizeof(nodeMask) + 1, MPOL_MF_MOVE);
 }
@@ -1,8 +1,17 @@
 #ifndef CPUCONF_H
 #define CPUCONF_H
 
+#include <stddef.h>
+
+#include "general.h"
+
+void selectPlacement(enum Placement policy);
+
 void initCPUData();
 void destroyCPUData();
 int getCPUForChild(int child);
+int getNodeForChild(int child);
+void attachChildToCPU(int child);
+void bindToChildNode(void* addr, size_t size, int child);
 
 #endif
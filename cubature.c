@@ -0,0 +1,232 @@
+#include <string.h>
+#include <math.h>
+
+#include "cubature.h"
+#include "kernel.h"
+
+void unitBox(struct Box* box)
+{
+	for (int i = 0; i < MAX_DIM - 1; i++)
+	{
+		box->lower[i] = 0;
+		box->upper[i] = 1;
+	}
+}
+
+double boxVolume(double left, double right, const struct Box* box)
+{
+	double volume = right - left;
+
+	for (int i = 0; i < MAX_DIM - 1; i++)
+		volume *= box->upper[i] - box->lower[i];
+
+	return volume;
+}
+
+static void boxAxes(double left, double right, const struct Box* box, int dim, double* center, double* half)
+{
+	center[0] = (left + right) / 2;
+	half[0] = (right - left) / 2;
+
+	for (int i = 1; i < dim; i++)
+	{
+		center[i] = (box->lower[i - 1] + box->upper[i - 1]) / 2;
+		half[i] = (box->upper[i - 1] - box->lower[i - 1]) / 2;
+	}
+}
+
+/*
+ * Degree 7 rule of Genz and Malik with its embedded degree 5 rule, for the cube
+ * [-1, 1]^dim scaled to unit volume: the center, 2 points on every axis at
+ * lambda2 and at lambda4, 4 points in every plane of two axes at lambda4, and
+ * the 2^dim corners of the cube at lambda5.
+ */
+static const double gmLambda2 = 0.358568582800318058634303497456;	// sqrt(9/70)
+static const double gmLambda4 = 0.948683298050513768018277005467;	// sqrt(9/10)
+static const double gmLambda5 = 0.688247201611685288646924618661;	// sqrt(9/19)
+
+// (lambda2 / lambda4)^2 cancels the second derivative in the fourth difference.
+#define GM_RATIO (1.0 / 7)
+
+long cubeGenzMalik(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis)
+{
+	double center[MAX_DIM], half[MAX_DIM], x[MAX_DIM];
+	double sum2 = 0, sum3 = 0, sum4 = 0, sum5 = 0;
+	double maxDifference = -1;
+
+	boxAxes(left, right, box, dim, center, half);
+	memcpy(x, center, sizeof(x));
+
+	double f0 = evaluatePoint(x, dim);
+	*axis = 0;
+
+	for (int i = 0; i < dim; i++)
+	{
+		double f2, f3;
+
+		x[i] = center[i] - half[i] * gmLambda2;
+		f2 = evaluatePoint(x, dim);
+		x[i] = center[i] + half[i] * gmLambda2;
+		f2 += evaluatePoint(x, dim);
+
+		x[i] = center[i] - half[i] * gmLambda4;
+		f3 = evaluatePoint(x, dim);
+		x[i] = center[i] + half[i] * gmLambda4;
+		f3 += evaluatePoint(x, dim);
+
+		x[i] = center[i];
+		sum2 += f2;
+		sum3 += f3;
+
+		// Of two axes that are as rough, the wider one is split.
+		double difference = fabs(f2 - 2 * f0 - GM_RATIO * (f3 - 2 * f0));
+		if (difference > maxDifference || (difference == maxDifference && half[i] > half[*axis]))
+		{
+			maxDifference = difference;
+			*axis = i;
+		}
+	}
+
+	for (int i = 0; i < dim; i++)
+		for (int j = i + 1; j < dim; j++)
+			for (int signs = 0; signs < 4; signs++)
+			{
+				x[i] = center[i] + (signs & 1 ? half[i] : -half[i]) * gmLambda4;
+				x[j] = center[j] + (signs & 2 ? half[j] : -half[j]) * gmLambda4;
+				sum4 += evaluatePoint(x, dim);
+				x[i] = center[i];
+				x[j] = center[j];
+			}
+
+	for (long corner = 0; corner < (1L << dim); corner++)
+	{
+		for (int i = 0; i < dim; i++)
+			x[i] = center[i] + (corner >> i & 1 ? half[i] : -half[i]) * gmLambda5;
+		sum5 += evaluatePoint(x, dim);
+	}
+
+	double w1 = (12824 - 9120 * dim + 400 * dim * dim) / 19683.0;
+	double w2 = 980 / 6561.0;
+	double w3 = (1820 - 400 * dim) / 19683.0;
+	double w4 = 200 / 19683.0;
+	double w5 = 6859 / 19683.0 / (1L << dim);
+
+	double v1 = (729 - 950 * dim + 50 * dim * dim) / 729.0;
+	double v2 = 245 / 486.0;
+	double v3 = (265 - 100 * dim) / 1458.0;
+	double v4 = 25 / 729.0;
+
+	double degree7 = w1 * f0 + w2 * sum2 + w3 * sum3 + w4 * sum4 + w5 * sum5;
+	double degree5 = v1 * f0 + v2 * sum2 + v3 * sum3 + v4 * sum4;
+
+	*I = degree7 * boxVolume(left, right, box);
+	*eps = fabs(degree7 - degree5);
+
+	return 1 + 4 * dim + 2 * dim * (dim - 1) + (1L << dim);
+}
+
+/*
+ * Gauss-Legendre nodes and weights on [-1, 1]. The error estimate comes from
+ * the 3-point rule on the outer nodes and the center, which is exact up to
+ * degree 3 and needs no evaluations of its own.
+ */
+static const double gaussNodes[GAUSS_POINTS] = {
+	-0.906179845938663992797626878299392,
+	-0.538469310105683091036314420700208,
+	0,
+	0.538469310105683091036314420700208,
+	0.906179845938663992797626878299392
+};
+
+static const double gaussWeights[GAUSS_POINTS] = {
+	0.236926885056189087514264040719918,
+	0.478628670499366468041291514835638,
+	0.568888888888888888888888888888889,
+	0.478628670499366468041291514835638,
+	0.236926885056189087514264040719918
+};
+
+// 1 / (3 a^2) at the outer nodes +-a and 2 - 2 / (3 a^2) at the center.
+static const double embeddedWeights[GAUSS_POINTS] = {
+	0.405928877095966422761108560735011,
+	0,
+	1.188142245808067265500085341045633,
+	0,
+	0.405928877095966422761108560735011
+};
+
+#define GAUSS_CENTER (GAUSS_POINTS / 2)
+
+/*
+ * Tensor product of the 5-point Gauss-Legendre rule. The nodes on the lines
+ * through the center along every axis give the 1-D estimates that pick the
+ * axis to split.
+ */
+long cubeGauss(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis)
+{
+	double center[MAX_DIM], half[MAX_DIM], x[MAX_DIM];
+	double line[MAX_DIM][GAUSS_POINTS];
+	int index[MAX_DIM] = {0};
+	double gauss = 0, embedded = 0;
+	long n = 0;
+
+	boxAxes(left, right, box, dim, center, half);
+
+	while (true)
+	{
+		double w = 1, we = 1;
+		int offCenter = 0, lineAxis = 0;
+
+		for (int i = 0; i < dim; i++)
+		{
+			x[i] = center[i] + half[i] * gaussNodes[index[i]];
+			w *= gaussWeights[index[i]] / 2;
+			we *= embeddedWeights[index[i]] / 2;
+
+			if (index[i] != GAUSS_CENTER)
+			{
+				offCenter++;
+				lineAxis = i;
+			}
+		}
+
+		double y = evaluatePoint(x, dim);
+		gauss += w * y;
+		embedded += we * y;
+		n++;
+
+		if (offCenter == 0)
+			for (int i = 0; i < dim; i++)
+				line[i][GAUSS_CENTER] = y;
+		else if (offCenter == 1)
+			line[lineAxis][index[lineAxis]] = y;
+
+		int i = 0;
+		while (i < dim && ++index[i] == GAUSS_POINTS)
+			index[i++] = 0;
+		if (i == dim)
+			break;
+	}
+
+	double maxDifference = -1;
+	*axis = 0;
+
+	for (int i = 0; i < dim; i++)
+	{
+		double difference = 0;
+		for (int k = 0; k < GAUSS_POINTS; k++)
+			difference += (gaussWeights[k] - embeddedWeights[k]) * line[i][k];
+		difference = fabs(difference);
+
+		if (difference > maxDifference || (difference == maxDifference && half[i] > half[*axis]))
+		{
+			maxDifference = difference;
+			*axis = i;
+		}
+	}
+
+	*I = gauss * boxVolume(left, right, box);
+	*eps = fabs(gauss - embedded);
+
+	return n;
+}
@@ -0,0 +1,22 @@
+#ifndef CUBATURE_H
+#define CUBATURE_H
+
+#include "general.h"
+
+// Tensor Gauss rule: GAUSS_POINTS Gauss-Legendre nodes along every axis.
+#define GAUSS_POINTS 5
+
+void unitBox(struct Box* box);
+double boxVolume(double left, double right, const struct Box* box);
+
+/*
+ * Cubature rules over the box [left, right] x box of dimension dim. Like the
+ * 1-D rules they store the integral in *I and its error estimate per unit of
+ * volume in *eps; *axis is the axis whose fourth difference is largest, along
+ * which the parent splits the box if it is refused. Return the number of
+ * integrand evaluations.
+ */
+long cubeGenzMalik(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis);
+long cubeGauss(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis);
+
+#endif
@@ -0,0 +1,17 @@
+#include <stddef.h>
+
+/*
+ * Integrand for './integrate --function=./libfunction.so'.
+ * Build with 'make libfunction.so'.
+ */
+
+double func(double x)
+{
+	return 4 * x * x * x;
+}
+
+void func_v(const double* x, double* y, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		y[i] = 4 * x[i] * x[i] * x[i];
+}
@@ -1,36 +1,174 @@
 #ifndef GENERAL_H
 #define GENERAL_H
 
-#include <sys/time.h>
-
 enum ErrorCode {
 	ERR_NO_ERROR,
 	ERR_BEST_FINENESS_REACHED,
 	ERR_CHILD_DISCONNECTED,
+	ERR_INTERRUPTED,
 	ERR_OTHER
 };
 
+enum Transport {
+	TR_AUTO,	// rings for thread workers, pipes for processes
+	TR_PIPE,
+	TR_SHM
+};
+
+enum Engine {
+	ENGINE_PROCESS,
+	ENGINE_THREAD,
+	ENGINE_STEAL
+};
+
+enum KernelImpl {
+	KERNEL_AUTO,
+	KERNEL_SCALAR,
+	KERNEL_AVX2,
+	KERNEL_AVX512
+};
+
+enum QuadRule {
+	RULE_TRAPEZOID,
+	RULE_GK15,
+	RULE_SIMPSON,
+	RULE_ROMBERG,
+	RULE_GENZ_MALIK,	// the cubature rules integrate over hyper-rectangles
+	RULE_GAUSS
+};
+
+enum Placement {
+	PLACEMENT_SCATTER,
+	PLACEMENT_COMPACT
+};
+
+enum Summation {
+	SUM_PLAIN,
+	SUM_NEUMAIER
+};
+
+enum Transform {
+	TRANSFORM_NONE,
+	TRANSFORM_TANH_SINH,	// x = tanh(pi/2 sinh t) scaled to [left, right], for endpoint singularities
+	TRANSFORM_RATIONAL		// x = t / (1 - t) and its mirrors, for infinite bounds
+};
+
+enum Adaptation {
+	ADAPT_LOCAL,	// accept every segment whose error per unit of width is below the job's
+	ADAPT_GLOBAL	// split the worst segment until the sum of the errors is below maxDeviation
+};
+
+struct Options
+{
+	enum Engine engine;
+	enum Transport transport;
+	enum KernelImpl kernel;
+	enum QuadRule rule;
+	enum Placement placement;
+	enum Summation summation;
+	enum Adaptation adapt;
+	enum Transform transform;
+	int batchSize;
+	int respawn;		// how many more lost children may be replaced
+	char* function;
+	char* trace;
+	char* stats;
+	char* jobs;
+	char* worker;
+	char* connect;
+	char* checkpoint;
+	int resume;
+	int reuse;
+	char* partition;
+};
+
+/*
+ * The trapezoid rule samples a segment in nSegments pieces of N_SUBSEGMENTS
+ * subsegments each. The root segment gets N_SEGMENTS pieces, later ones as
+ * few as their width and the error of their parent allow.
+ */
+#define N_SEGMENTS 0x1000
+#define N_SUBSEGMENTS 0x100
+#define MIN_SEGMENTS 0x10
+
+// The halves of a refused segment are sampled this much finer than the estimate asks for.
+#define SEGMENTS_SAFETY 1.25
+
+#define MAX_DIM 6
+
+/*
+ * Values at the nodes of a nested rule, 2^(ROMBERG_LEVELS - 1) + 1 at most. A
+ * half of a segment shares every other node with it, MAX_KNOWN at most. They
+ * travel next to the requests and answers, in the batches, and only with --reuse.
+ */
+#define MAX_NODES 33
+#define MAX_KNOWN (MAX_NODES / 2 + 1)
+
+/*
+ * Axes 1 to MAX_DIM - 1 of a hyper-rectangle; axis 0 is [left, right] of the
+ * segment or request that holds it. In a 1-D integral, and past the dimension
+ * of a box, every axis is [0, 1], so volumes and splits need not know the
+ * dimension.
+ */
+struct Box
+{
+	double lower[MAX_DIM - 1];
+	double upper[MAX_DIM - 1];
+};
+
 struct CalcRequest
 {
 	double left;
 	double right;
 	double dens;
+	int nSegments;
+	int dim;
 
-	struct timeval sent;
+	// --reuse: the values at the nodes come back; those at the nKnown even ones are in CalcBatch.known.
+	int reuse;
+	int nKnown;
+
+	struct Box box;
+
+	long sent;		// microseconds, see nowMicros()
 };
 
 struct ChildAnswer
 {
 	double S;
 	double eps;
+	long evaluations;
+	int axis;		// along which a box with too large an error is split
+	int nNodes;		// values at the nodes of a nested rule in AnswerBatch.nodes, see CalcRequest.reuse
 
-	struct timeval sent;
-	struct timeval received;
-	struct timeval sentBack;
+	long sent;		// when the parent sent the request
+	long received;	// when the child took the batch of the request
+	long started;	// when the child started on it
+	long sentBack;	// when the child finished it
 
 	enum ErrorCode error;	
 };
 
+#define MAX_BATCH 0x20
+
+/*
+ * One message in either direction. Only the first n entries travel over a pipe,
+ * followed by the first nKnown or nNodes values of each of their rows.
+ */
+struct CalcBatch
+{
+	int n;
+	struct CalcRequest rq[MAX_BATCH];
+	double known[MAX_BATCH][MAX_KNOWN];
+};
+
+struct AnswerBatch
+{
+	int n;
+	struct ChildAnswer ans[MAX_BATCH];
+	double nodes[MAX_BATCH][MAX_NODES];
+};
+
 #define true 1
 #define false 0
 
@@ -10,25 +10,37 @@
 #include <sys/sysinfo.h>
 #include <signal.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include <wait.h>
 #include <sched.h>
 #include <math.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include "ui.h"
 #include "list.h"
 #include "general.h"
 #include "cpuconf.h"
+#include "shm.h"
+#include "kernel.h"
+#include "steal.h"
+#include "trace.h"
+#include "stats.h"
+#include "jobs.h"
+#include "net.h"
+#include "checkpoint.h"
+#include "partition.h"
+#include "cubature.h"
 
 
-#define BEST_FINENESS 1e-12
-
 enum requestOrder { RQ_FIRST, RQ_LAST };
 
-inline double f(double x)
-{
-	return 4 * x * x * x;
-}
+// A batch should take this many times longer to compute than an answer takes to be picked up.
+#define BATCH_LATENCY_FACTOR 4
+
+// Set by SIGCHLD. Over shared memory a dead child leaves no end of file behind, so the parent looks for it.
+static volatile sig_atomic_t childExited = false;
 
 struct Connection
 {
@@ -36,123 +48,682 @@ struct Connection
 	int wr;
 	int waiting;
 	int closed;
+
+	pid_t pid;
+	pthread_t thread;
+	struct ShmRegion* shm;
+	struct NetPeer* net;
+
+	struct Options* opts;
+	const double* samples;	// sampleIntegrand(), which remote workers must match
+	int generation;		// bumped every time the child is lost
+
+	int batch;
+	int adaptiveBatch;
+	long computeMicros;
+	int answered;
 };
 
 
-void createChildren(struct Connection* *con, int nChildren);
+void createChildren(struct Connection* *con, int nChildren, struct Options* opts);
+int startChild(struct Connection* con, int nChildren, int i, struct Options* opts);
 void destroyChildren(struct Connection* con, int nChildren);
 
-void calcSums(double left, double right, double* I, double* eps, enum ErrorCode* error);
-void childCalcSums(int rd, int wr, int child);
+void childCalcSums(struct Connection* con, int child);
+void runWorker(struct Options* opts);
 
-double parentIntegrate(struct Connection* con, int nChildren, double left, double right, double maxDeviation, enum ErrorCode* error);
+void runJobs(struct Connection* con, int nChildren, struct JobQueue* queue, long* evaluations, enum ErrorCode* error);
+double parentIntegrate(struct Connection* con, int nChildren, double left, double right, const struct Box* box, int dim, double maxDeviation, long* evaluations, enum ErrorCode* error);
 
 
 int main(int argc, char* argv[])
 {
 	double left, right, maxDeviation;
+	struct Box box;
+	int dim;
 	int nChildren;
 	enum ErrorCode error;
+	long evaluations;
+	struct Options opts;
+
+	parseArgs(argc, argv, &left, &right, &box, &dim, &nChildren, &maxDeviation, &opts);
+	selectKernel(opts.kernel);
+	selectRule(opts.rule);
+	selectPlacement(opts.placement);
+	selectSummation(opts.summation);
+	if (opts.function != NULL && !loadFunction(opts.function))
+		exitErrorMsg("Failed to load the integrand.\n");
+
+	if (opts.worker != NULL)
+	{
+		runWorker(&opts);
+		return 0;
+	}
+
+	if (!supportsDimension(dim))
+		exitErrorMsg("The integrand is not defined for this number of dimensions.\n");
+
+	// The parent and the children work on the transformed interval; the answer is printed for the original one.
+	double from = left, to = right;
+	if (opts.transform != TRANSFORM_NONE
+		&& (opts.jobs != NULL || opts.connect != NULL || opts.checkpoint != NULL || opts.partition != NULL))
+		exitErrorMsg("Transforms need a single integral on this host without a checkpoint or partition.\n");
+	selectTransform(opts.transform, &left, &right);
+
+	/*
+	 * Thread workers live in the parent's memory, so the rings are their queue:
+	 * one per worker rather than one shared, because the parent tracks every
+	 * segment in flight per child to order, batch and requeue them.
+	 */
+	if (opts.transport == TR_AUTO)
+		opts.transport = opts.engine == ENGINE_THREAD && opts.connect == NULL ? TR_SHM : TR_PIPE;
+
+	if (opts.connect != NULL)
+	{
+		if (opts.engine == ENGINE_STEAL)
+			exitErrorMsg("Remote workers need the process or thread engine.\n");
+		if (opts.transport == TR_SHM)
+			exitErrorMsg("Remote workers are reached over TCP, not shared memory.\n");
+		nChildren *= netCountEndpoints(opts.connect);
+	}
+
+	if (opts.trace != NULL)
+		traceInit(opts.trace, nChildren);
+	if (opts.stats != NULL && !statsOpen(opts.stats, nChildren))
+		exitErrorMsg("Failed to open the statistics channel.\n");
+
+	if (dim > 1 && (opts.engine == ENGINE_STEAL || opts.checkpoint != NULL))
+		exitErrorMsg("Boxes need the process or thread engine and cannot be checkpointed.\n");
+
+	if (opts.adapt == ADAPT_GLOBAL && (opts.engine == ENGINE_STEAL || opts.checkpoint != NULL))
+		exitErrorMsg("Global adaptation needs the process or thread engine and cannot be checkpointed.\n");
+
+	if (opts.reuse && opts.engine == ENGINE_STEAL)
+		exitErrorMsg("--reuse needs the process or thread engine.\n");
+
+	if (opts.partition != NULL)
+	{
+		if (opts.jobs != NULL || opts.engine == ENGINE_STEAL || dim > 1 || opts.adapt == ADAPT_GLOBAL || opts.checkpoint != NULL)
+			exitErrorMsg("Partitions need a single 1-D integral on the process or thread engine with local adaptation and no checkpoint.\n");
+		if (!partitionOpen(opts.partition, left, right))
+			exitErrorMsg("Failed to load the partition.\n");
+	}
+
+	if (opts.checkpoint != NULL)
+	{
+		if (opts.jobs != NULL || opts.engine == ENGINE_STEAL)
+			exitErrorMsg("Checkpoints need a single integral on the process or thread engine.\n");
+		if (!checkpointOpen(opts.checkpoint, opts.resume, left, right, maxDeviation))
+			exitErrorMsg("Failed to resume.\n");
+	}
 
-	parseArgs(argc, argv, &left, &right, &nChildren, &maxDeviation);
+	if (opts.jobs != NULL)
+	{
+		struct JobQueue queue;
+		struct Connection* con;
+
+		if (opts.engine == ENGINE_STEAL)
+			exitErrorMsg("Batch mode needs the process or thread engine.\n");
+		if (!openJobs(&queue, opts.jobs, nChildren * JOBS_PER_CHILD))
+			exitErrorMsg("Failed to open the jobs.\n");
+
+		createChildren(&con, nChildren, &opts);
+		runJobs(con, nChildren, &queue, &evaluations, &error);
+
+		if (error == ERR_NO_ERROR)
+			printEvaluations(evaluations);
+		else
+			explainError(error);
+
+		destroyChildren(con, nChildren);
+		closeJobs(&queue);
+		traceFinish();
+		statsClose();
+		return 0;
+	}
+
+	if (opts.engine == ENGINE_STEAL)
+	{
+		double I = stealIntegrate(nChildren, left, right, maxDeviation, &evaluations, &error);
+		if (error == ERR_NO_ERROR)
+		{
+			printAnswer(from, to, maxDeviation, I);
+			printEvaluations(evaluations);
+		}
+		else
+			explainError(error);
+
+		traceFinish();
+		statsClose();
+		return 0;
+	}
 
 	struct Connection* con;
-	createChildren(&con, nChildren);
+	createChildren(&con, nChildren, &opts);
 
-	double I = parentIntegrate(con, nChildren, left, right, maxDeviation, &error);
+	double I = parentIntegrate(con, nChildren, left, right, &box, dim, maxDeviation, &evaluations, &error);
 	if (error == ERR_NO_ERROR)
-		printAnswer(left, right, maxDeviation, I);
+	{
+		printAnswer(from, to, maxDeviation, I);
+		printEvaluations(evaluations);
+		printPoolStats();
+	}
 	else
 		explainError(error);
 
 	destroyChildren(con, nChildren);
+	checkpointClose(error == ERR_NO_ERROR);
+	partitionClose(error == ERR_NO_ERROR);
+	traceFinish();
+	statsClose();
 
 	return 0;
 }
 
-void makeRequest(struct UnstudiedSegment* seg, struct CalcRequest* rq, int child, enum requestOrder order, double dens)
+void makeRequest(struct UnstudiedSegment* seg, struct CalcRequest* rq, double* known, int child, enum requestOrder order, struct JobQueue* queue)
 {
+	struct Job* job = &queue->jobs[seg->job];
+
 	rq->left = seg->left;
 	rq->right = seg->right;
-	rq->dens = dens;
+	rq->dens = job->dens;
+	rq->nSegments = seg->nSegments;
+	rq->dim = job->dim;
+	rq->box = seg->box;
+	rq->reuse = queue->reuse;
+	rq->nKnown = seg->nodes != NULL ? seg->nodes->nKnown : 0;
+	if (rq->nKnown > 0)
+		memcpy(known, seg->nodes->values, rq->nKnown * sizeof(double));
 
-	gettimeofday(&(rq->sent), NULL);
+	rq->sent = nowMicros();
 
 	if (order == RQ_FIRST)
-		seg->child = child + 1;
+		setSegChild(seg, child + 1);
 	else
-		seg->child = -(child + 1);
+		setSegChild(seg, -(child + 1));
 }
 
-void closeChild(struct Connection* con, struct SegmentList segList, int child)
+/*
+ * Puts the segments a lost child had in flight back into the free pool, so that
+ * the others finish its work, and starts a replacement on the same CPU while
+ * --respawn allows. Threads die with the parent and are not replaced.
+ */
+void loseChild(struct Connection* con, int nChildren, struct SegmentList segList, int child)
 {
-	struct UnstudiedSegment* seg;
-
-	seg = getSeg(segList, child + 1);
-	if (seg != NULL)
-		seg->child = 0;
+	int requeued = moveSegs(segList, child + 1, 0) + moveSegs(segList, -(child + 1), 0);
+	int respawned = false;
 
-	getSeg(segList, -(child + 1))->child = 0;
-	if (seg != NULL)
-		seg->child = 0;
+	fprintf(stderr, "Lost connection with child %d, %d segments go to the others\n", child, requeued);
 
 	con[child].closed = true;
-	//fprintf(stderr, "Lost connection with child %d: %s (%d)\n", child, strerror(errno), errno);
-	fprintf(stderr, "Lost connection with child %d\n", child);
+	con[child].generation++;
+
+	if (con[child].net != NULL)
+		netClose(con[child].net);
+	else if (con[child].shm == NULL)
+	{
+		close(con[child].rd);
+		close(con[child].wr);
+	}
+	con[child].net = NULL;
+	con[child].rd = -1;
+	con[child].wr = -1;
+
+	if (con[child].pid > 0)
+	{
+		kill(con[child].pid, SIGKILL);
+		waitpid(con[child].pid, NULL, 0);
+		con[child].pid = -1;
+	}
+
+	if (con[child].pid != 0 && con[child].opts->respawn > 0)
+	{
+		con[child].opts->respawn--;
+		if (con[child].shm != NULL)
+			shmResetChannel(con[child].shm, child);
+
+		respawned = startChild(con, nChildren, child, con[child].opts);
+		if (respawned)
+			fprintf(stderr, "Child %d restarted\n", child);
+	}
+
+	errno = 0;
+	statsWorkerLost(child, requeued, respawned);
 }
 
-void sendRequest
-(struct Connection* con, struct SegmentList segList, struct UnstudiedSegment* seg, 
-int child, enum requestOrder order, double dens, enum ErrorCode* error)
+/*
+ * Writes a message to a pipe: size bytes of the batch, then the first counts[i]
+ * of the width values in every row i of rows. Returns false if it was cut short.
+ */
+static int writeMessage(int fd, const void* batch, size_t size, const double* rows, int width, const int* counts, int n)
 {
-	struct CalcRequest rq;
-	int bytesWritten;
+	struct iovec iov[1 + MAX_BATCH];
+	size_t total = size;
+	int nIov = 1;
 
-	makeRequest(seg, &rq, child, order, dens);
-	bytesWritten = write(con[child].wr, &rq, sizeof(rq));
-	if (errno != 0 || bytesWritten != sizeof(rq))
+	iov[0] = (struct iovec){(void*)batch, size};
+	for (int i = 0; i < n; i++)
+		if (counts[i] > 0)
+		{
+			iov[nIov++] = (struct iovec){(void*)(rows + i * width), counts[i] * sizeof(double)};
+			total += counts[i] * sizeof(double);
+		}
+
+	return writev(fd, iov, nIov) == (ssize_t)total;
+}
+
+/*
+ * Whether a free segment can be sent. In global mode an evaluated one only
+ * counts while the error of its job is above the tolerance.
+ */
+static int sendable(struct UnstudiedSegment* seg, void* queue)
+{
+	return !seg->evaluated || ((struct JobQueue*)queue)->jobs[seg->job].errorEstimate >= 1;
+}
+
+/*
+ * Whether any free segment can be sent. In a batch, the evaluated segments of a
+ * job within its tolerance may sit above those of the others.
+ */
+int canSend(struct SegmentList segList, struct JobQueue* queue)
+{
+	return getFreeSegWhere(segList, sendable, queue) != NULL;
+}
+
+/*
+ * Takes the worst free segment to send, or NULL. An evaluated one is split and
+ * one of its halves, which now are the worst, goes instead.
+ */
+struct UnstudiedSegment* nextSegment(struct SegmentList segList, struct JobQueue* queue)
+{
+	struct UnstudiedSegment* seg = getFreeSegWhere(segList, sendable, queue);
+	if (seg == NULL)
+		return NULL;
+
+	if (seg->evaluated)
 	{
-		closeChild(con, segList, child);
-		errno = 0;
-		*error = ERR_CHILD_DISCONNECTED;
+		struct Job* job = &queue->jobs[seg->job];
+
+		job->errorEstimate -= seg->err;
+		job->evaluating += 2;
+		job->pending++;
+		split(seg);
+		seg = getSeg(segList, 0);
+	}
+
+	return seg;
+}
+
+/*
+ * Sends the child a batch of the worst free segments. There must be at least one.
+ * The batch never takes more than the child's share of the free segments.
+ * Returns false if the child turned out to be lost.
+ */
+int sendRequest
+(struct Connection* con, int nChildren, struct SegmentList segList,
+int child, enum requestOrder order, struct JobQueue* queue)
+{
+	struct CalcBatch batch;
+	struct UnstudiedSegment* seg;
+	int share = (freeLen(segList) + nChildren - 1) / nChildren;
+	int sent;
+
+	batch.n = 0;
+	while (batch.n < con[child].batch && batch.n < share && (seg = nextSegment(segList, queue)) != NULL)
+	{
+		makeRequest(seg, &batch.rq[batch.n], batch.known[batch.n], child, order, queue);
+		batch.n++;
+	}
+
+	if (con[child].shm != NULL)
+		sent = shmPushRequests(con[child].shm, child, &batch);
+	else if (con[child].net != NULL)
+		sent = netSendRequests(con[child].net, &batch);
+	else
+	{
+		int counts[MAX_BATCH];
+
+		for (int i = 0; i < batch.n; i++)
+			counts[i] = batch.rq[i].nKnown;
+		sent = writeMessage(con[child].wr, &batch, offsetof(struct CalcBatch, rq) + batch.n * sizeof(struct CalcRequest),
+			batch.known[0], MAX_KNOWN, counts, batch.n);
 	}
 
 	con[child].waiting = false;
+
+	if (errno != 0 || !sent)
+	{
+		loseChild(con, nChildren, segList, child);
+		return false;
+	}
+
+	return true;
 }
 
+/*
+ * Sizes the next batch so that computing it hides the time answers wait for the parent.
+ */
+void adaptBatch(struct Connection* con, struct ChildAnswer* ans)
+{
+	if (con->adaptiveBatch && con->answered > 0)
+	{
+		double compute = (double)con->computeMicros / con->answered;
+		double latency = nowMicros() - ans->sentBack;
+		int batch = compute > 0 ? (int)ceil(BATCH_LATENCY_FACTOR * latency / compute) : MAX_BATCH;
+
+		if (batch > 2 * con->batch)
+			batch = 2 * con->batch;
+		if (batch > MAX_BATCH)
+			batch = MAX_BATCH;
+		if (batch < 1)
+			batch = 1;
+
+		con->batch = batch;
+	}
+
+	con->computeMicros = 0;
+	con->answered = 0;
+}
+
+/*
+ * Starts jobs from the queue while there is room for them.
+ */
+void startJobs(struct JobQueue* queue, struct SegmentList segList, struct StatsSample* progress)
+{
+	for (int i = 0; i < queue->size && queue->nActive < queue->size; i++)
+	{
+		struct Job* job = &queue->jobs[i];
+
+		if (job->active)
+			continue;
+		if (!readJob(queue, job))
+			return;
+
+		job->active = true;
+		job->pending = 1;
+		job->evaluating = 1;
+		job->errorEstimate = 0;
+		queue->nActive++;
+
+		appendSeg(segList, job->left, job->right, i)->box = job->box;
+		progress->width += boxVolume(job->left, job->right, &job->box);
+		progress->maxDeviation += job->maxDeviation;
+	}
+}
+
+void finishJob(struct JobQueue* queue, struct Job* job)
+{
+	job->active = false;
+	queue->nActive--;
+	completeJob(job);
+
+	if (queue->in != NULL)
+		printJobResult(job->id, job->left, job->right, job->maxDeviation, job->I, job->errorSpent, job->error);
+}
+
+/*
+ * Global mode: the sum of the errors of the job is below its tolerance, so all
+ * its segments are accepted.
+ */
+void acceptJob(struct SegmentList segList, struct Job* job, int index, struct StatsSample* progress)
+{
+	struct UnstudiedSegment* seg = segList.head->next;
+
+	while (seg != segList.head)
+	{
+		struct UnstudiedSegment* next = seg->next;
+
+		if (seg->job == index)
+		{
+			double error = seg->err * job->maxDeviation;
+
+			progress->resolvedWidth += segVolume(seg);
+			progress->errorSpent += error;
+			progress->completed++;
+
+			acceptSegment(job, seg->left, &seg->box, seg->S);
+			job->errorSpent += error;
+			progress->I += removeSeg(seg);
+			job->pending--;
+		}
+
+		seg = next;
+	}
+}
+
+/*
+ * Answers of a batch come back in the order the segments were sent. Once the
+ * RQ_FIRST batch is complete, the queued RQ_LAST batch takes its place and a
+ * new RQ_LAST batch is sent, so the child always has work queued.
+ */
 void handleSegmentData
-(struct Connection* con, struct SegmentList segList, struct ChildAnswer* ans, int child, double* I, double dens, enum ErrorCode* error)
+(struct Connection* con, int nChildren, struct SegmentList segList, struct ChildAnswer* ans, const double* nodes, int child,
+struct JobQueue* queue, struct StatsSample* progress, enum ErrorCode* error)
 {
 	struct UnstudiedSegment* seg = getSeg(segList, child + 1);
 
-	if (ans->eps < dens)
+	if (seg == NULL)
 	{
+		*error = ERR_OTHER;
+		return;
+	}
+
+	struct Job* job = &queue->jobs[seg->job];
+	double width = segVolume(seg);
+
+	progress->evaluations += ans->evaluations;
+
+	// Kept for the halves in case the segment is split.
+	if (queue->reuse)
+		setSegNodes(seg, nodes, ans->nNodes);
+
+	if (ans->error != ERR_NO_ERROR && job->error == ERR_NO_ERROR)
+	{
+		// The job is lost. Its free segments go now, those in flight as they come back.
+		job->error = ans->error;
+		job->pending -= removeJobSegs(segList, seg->job);
+	}
+
+	if (job->error != ERR_NO_ERROR)
+	{
+		removeSeg(seg);
+		job->pending--;
+	}
+	else if (queue->global)
+	{
+		// The segment waits in the free list until it is the worst one or its job is done.
 		seg->S = ans->S;
-		*I += removeSeg(seg);
+		seg->err = ans->eps * width / job->maxDeviation;
+		seg->nSegments = chooseSegments(seg->nSegments, ans->eps, job->dens);
+		seg->axis = ans->axis;
+		seg->evaluated = true;
+		setSegChild(seg, 0);
+
+		job->errorEstimate += seg->err;
+		if (--job->evaluating == 0 && job->errorEstimate < 1)
+			acceptJob(segList, job, seg->job, progress);
+	}
+	else if (ans->eps < job->dens)
+	{
+		progress->resolvedWidth += width;
+		progress->errorSpent += ans->eps * width;
+		progress->completed++;
+
+		seg->S = ans->S;
+		acceptSegment(job, seg->left, &seg->box, seg->S);
+		partitionAccept(seg->left, seg->right, seg->S, ans->eps, seg->nSegments);
+		job->errorSpent += ans->eps * width;
+		progress->I += removeSeg(seg);
+		job->pending--;
 	}
 	else
 	{
+		// Measured against the job's tolerance, so that jobs of any scale take turns.
+		seg->err = ans->eps * width / job->maxDeviation;
+		seg->nSegments = chooseSegments(seg->nSegments, ans->eps, job->dens);
+		seg->axis = ans->axis;
 		split(seg);
+		job->pending++;
 	}
 
-	seg = getSeg(segList, -(child + 1));
-	if (seg != NULL)
-		seg->child = child + 1;
+	if (job->pending == 0)
+		finishJob(queue, job);
+
+	con[child].computeMicros += ans->sentBack - ans->started;
+	statsBusy(child, ans->started, ans->sentBack);
+	con[child].answered++;
+
+	if (getSeg(segList, child + 1) != NULL)
+		return;
+
+	adaptBatch(&con[child], ans);
+
+	if (getSeg(segList, -(child + 1)) != NULL)
+		moveSegs(segList, -(child + 1), child + 1);
 	else
 	{
-		seg = getSeg(segList, 0);
-		if (seg == NULL)
+		if (!canSend(segList, queue))
 		{
 			con[child].waiting = true;
 			return;
 		}
 		
-		sendRequest(con, segList, seg, child, RQ_FIRST, dens, error);
+		if (!sendRequest(con, nChildren, segList, child, RQ_FIRST, queue))
+			return;
+	}
+
+	if (canSend(segList, queue))
+		sendRequest(con, nChildren, segList, child, RQ_LAST, queue);
+}
+
+static int readFull(int fd, void* buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t bytesRead;
+
+	while (done < size)
+	{
+		bytesRead = read(fd, (char*)buf + done, size - done);
+		if (bytesRead <= 0)
+			return false;
+		done += bytesRead;
+	}
+
+	return errno == 0;
+}
+
+/*
+ * Reads the values that follow the entries of a message from a pipe: the first
+ * counts[i] of the width values in every row i of rows.
+ */
+static int readRows(int fd, double* rows, int width, const int* counts, int n)
+{
+	for (int i = 0; i < n; i++)
+		if (counts[i] < 0 || counts[i] > width || (counts[i] > 0 && !readFull(fd, rows + i * width, counts[i] * sizeof(double))))
+			return false;
+
+	return true;
+}
+
+/*
+ * Reads the answers of a ready child. Returns false if the child is gone.
+ */
+int readAnswers(struct Connection* con, int child, struct AnswerBatch* answers)
+{
+	if (con[child].shm != NULL)
+		return shmPopAnswers(con[child].shm, child, answers);
+	if (con[child].net != NULL)
+		return netReadAnswers(con[child].net, answers);
+
+	int counts[MAX_BATCH];
+
+	if (!readFull(con[child].rd, answers, offsetof(struct AnswerBatch, ans))
+		|| answers->n <= 0 || answers->n > MAX_BATCH
+		|| !readFull(con[child].rd, answers->ans, answers->n * sizeof(struct ChildAnswer)))
+		return false;
+
+	for (int i = 0; i < answers->n; i++)
+		counts[i] = answers->ans[i].nNodes;
+	return readRows(con[child].rd, answers->nodes[0], MAX_NODES, counts, answers->n);
+}
+
+static void onChildExit(int sig)
+{
+	(void)sig;
+	childExited = true;
+}
+
+/*
+ * Whether a forked child has exited. It stays a zombie until loseChild() reaps it,
+ * so that its pid cannot be reused before.
+ */
+static int childGone(pid_t pid)
+{
+	siginfo_t info;
+
+	info.si_pid = 0;
+	return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid != 0;
+}
+
+/*
+ * Blocks until at least one child has something to say and marks such children in ready[].
+ * Over shared memory the kernel is only entered once spinning found no answers; a child that
+ * died is marked ready so that readAnswers() reports it, as soon as SIGCHLD says one did,
+ * while the others go on answering. Remote workers are waited for at most NET_HEARTBEAT_MS,
+ * so that the heartbeats keep going.
+ */
+void waitForAnswers(struct Connection* con, int nChildren, int* ready)
+{
+	if (con[0].shm == NULL)
+	{
+		fd_set rd;
+		struct timeval heartbeat = {0, NET_HEARTBEAT_MS * 1000L};
+		int maxFd = -1;
+
+		FD_ZERO(&rd);
+		for (int i = 0; i < nChildren; i++)
+			if (!(con[i].closed))
+			{
+				FD_SET(con[i].rd, &rd);
+				if (con[i].rd > maxFd)
+					maxFd = con[i].rd;
+			}
+
+		// A signal for the checkpoint ends the wait with nothing ready.
+		if (select(maxFd + 1, &rd, NULL, NULL, con[0].net != NULL ? &heartbeat : NULL) < 0)
+		{
+			FD_ZERO(&rd);
+			errno = 0;
+		}
+
+		for (int i = 0; i < nChildren; i++)
+			ready[i] = !(con[i].closed) && FD_ISSET(con[i].rd, &rd);
+		return;
 	}
 
-	seg = getSeg(segList, 0);
-	if (seg != NULL)
-		sendRequest(con, segList, seg, child, RQ_LAST, dens, error);
+	int any = shmWaitAnswers(con[0].shm, SHM_WAIT_TIMEOUT_MS);
+
+	// Cleared before the children are looked at, so that an exit after that is not missed.
+	int exited = childExited;
+	childExited = false;
+
+	for (int i = 0; i < nChildren; i++)
+	{
+		ready[i] = false;
+		if (con[i].closed)
+			continue;
+
+		if (any)
+			ready[i] = shmHasAnswer(con[i].shm, i);
+		if ((exited || !any) && con[i].pid > 0 && childGone(con[i].pid))
+		{
+			// Its last answers are taken first; the next wait finds it again.
+			if (ready[i])
+				childExited = true;
+			ready[i] = true;
+		}
+	}
+	errno = 0;
 }
 
 int isClosed(struct Connection* con, int nChildren)
@@ -163,236 +734,456 @@ int isClosed(struct Connection* con, int nChildren)
 	return true;
 }
 
-double parentIntegrate(struct Connection* con, int nChildren, double left, double right, double maxDeviation, enum ErrorCode* error)
+/*
+ * Runs every job of the queue through the children. Segments of all active jobs
+ * share one list, so the children stay busy while single jobs run dry.
+ */
+void runJobs(struct Connection* con, int nChildren, struct JobQueue* queue, long* evaluations, enum ErrorCode* error)
 {
-	double dens = maxDeviation / (right - left);
-	struct ChildAnswer ans;
-	struct SegmentList segList = initList(left, right);
-	struct UnstudiedSegment* seg;
-	double I = 0;
-	fd_set rd;
+	struct AnswerBatch answers;
+	struct SegmentList segList = emptyList();
+	struct StatsSample progress = {0};
+	int* ready = malloc(sizeof(int) * nChildren);
+
+	*error = ERR_NO_ERROR;
+	queue->global = con[0].opts->adapt == ADAPT_GLOBAL;
+	queue->reuse = con[0].opts->reuse;
+	startJobs(queue, segList, &progress);
+	checkpointRestore(segList, &queue->jobs[0], &progress);
+	partitionRestore(segList, &queue->jobs[0], &progress);
+	if (queue->jobs[0].active && queue->jobs[0].pending == 0)
+		finishJob(queue, &queue->jobs[0]);
 
 	while (!isEmpty(segList))
 	{
+		long dispatched = nowMicros();
+
+		if (checkpointInterrupted())
+		{
+			checkpointSave(segList, &queue->jobs[0], &progress, true);
+			*error = ERR_INTERRUPTED;
+			break;
+		}
+
 		for (int i = 0; i < nChildren; i++)
-			if (!(con[i].closed) && con[i].waiting && (seg = getSeg(segList, 0)) != NULL)
-				sendRequest(con, segList, seg, i, RQ_FIRST, dens, error);
+			if (!(con[i].closed) && con[i].waiting && canSend(segList, queue))
+				sendRequest(con, nChildren, segList, i, RQ_FIRST, queue);
 		
 		if (isClosed(con, nChildren))
-			*error = ERR_OTHER;
+			*error = ERR_CHILD_DISCONNECTED;
 
 		if (*error != ERR_NO_ERROR)	break;
 
-		FD_ZERO(&rd);
-		for (int i = 0; i < nChildren; i++)
-			if (!(con[i].closed))
-				FD_SET(con[i].rd, &rd);
+		long waited = nowMicros();
+		waitForAnswers(con, nChildren, ready);
+		long woken = nowMicros();
 
-		select(nChildren * 2 + 10, &rd, NULL, NULL, NULL);
+		traceSpan(0, "dispatch", dispatched, waited);
+		traceSpan(0, "select", waited, woken);
 
 		for (int i = 0; i < nChildren; i++)
-			if (FD_ISSET(con[i].rd, &rd))
+			if (ready[i])
 			{
-				if (read(con[i].rd, &ans, sizeof(ans)) == 0 || errno != 0 || ans.error != ERR_NO_ERROR)
+				if (!readAnswers(con, i, &answers))
 				{
-					closeChild(con, segList, i);
-					if (ans.error == ERR_NO_ERROR)
-						*error = ERR_CHILD_DISCONNECTED;
-					else
-						*error = ans.error;
-					break;
+					loseChild(con, nChildren, segList, i);
+					continue;
 				}
 
-				handleSegmentData(con, segList, &ans, i, &I, dens, error);
+				long collected = nowMicros();
+				for (int k = 0; k < answers.n; k++)
+					traceAnswer(i, &answers.ans[k], collected);
+
+				// If the child is lost on the way, the rest of the batch has been requeued.
+				int generation = con[i].generation;
+				for (int k = 0; k < answers.n && con[i].generation == generation; k++)
+				{
+					handleSegmentData(con, nChildren, segList, &answers.ans[k], answers.nodes[k], i, queue, &progress, error);
+					if (*error != ERR_NO_ERROR) break;
+				}
 				if (*error != ERR_NO_ERROR) break;
 			}
 
 		if (*error != ERR_NO_ERROR) break;
-		printProgress(segList, left, right, I);
+
+		for (int i = 0; i < nChildren; i++)
+			if (con[i].net != NULL && !(con[i].closed) && !netKeepAlive(con[i].net))
+				loseChild(con, nChildren, segList, i);
+
+		startJobs(queue, segList, &progress);
+		if (queue->in == NULL)
+			printProgress(segList, queue->jobs[0].left, queue->jobs[0].right, progress.I);
+
+		progress.nFree = freeLen(segList);
+		progress.nInFlight = listLen(segList) - progress.nFree;
+		statsReport(&progress, isEmpty(segList));
+		checkpointSave(segList, &queue->jobs[0], &progress, false);
+
+		traceSpan(0, "dispatch", woken, nowMicros());
 	}
 
 	destroyList(segList);
+	free(ready);
 
+	*evaluations = progress.evaluations;
+}
+
+double parentIntegrate(struct Connection* con, int nChildren, double left, double right, const struct Box* box, int dim, double maxDeviation, long* evaluations, enum ErrorCode* error)
+{
+	struct JobQueue queue;
+
+	initSingleJob(&queue, left, right, box, dim, maxDeviation);
+	runJobs(con, nChildren, &queue, evaluations, error);
+
+	double I = queue.jobs[0].I;
+	if (*error == ERR_NO_ERROR)
+		*error = queue.jobs[0].error;
+
+	closeJobs(&queue);
 	return I;
 }
 
-void attachChildToCPU(int child)
+int childReceive(struct Connection* con, int child, struct CalcBatch* batch)
 {
-	int cpu = getCPUForChild(child);
-	destroyCPUData();
+	if (con->shm != NULL)
+		return shmPopRequests(con->shm, child, batch);
+	if (con->net != NULL)
+		return netReadRequests(con->net, batch);
 
-	cpu_set_t set;
-	CPU_ZERO(&set);
-	CPU_SET(cpu, &set);
-	sched_setaffinity(0, sizeof(set), &set);
-	if (errno != 0)
-	{
-		fprintf(stderr, "Failed to attach child %d to CPU %d: %s (%d)\n", child, cpu, strerror(errno), errno);
-		errno = 0;
-	}
+	int counts[MAX_BATCH];
+
+	if (!readFull(con->rd, batch, offsetof(struct CalcBatch, rq))
+		|| batch->n <= 0 || batch->n > MAX_BATCH
+		|| !readFull(con->rd, batch->rq, batch->n * sizeof(struct CalcRequest)))
+		return false;
+
+	for (int i = 0; i < batch->n; i++)
+		counts[i] = batch->rq[i].nKnown;
+	return readRows(con->rd, batch->known[0], MAX_KNOWN, counts, batch->n);
+}
+
+int childSend(struct Connection* con, int child, struct AnswerBatch* answers)
+{
+	if (con->shm != NULL)
+		return shmPushAnswers(con->shm, child, answers);
+	if (con->net != NULL)
+		return netSendAnswers(con->net, answers);
+
+	int counts[MAX_BATCH];
+
+	for (int i = 0; i < answers->n; i++)
+		counts[i] = answers->ans[i].nNodes;
+	return writeMessage(con->wr, answers, offsetof(struct AnswerBatch, ans) + answers->n * sizeof(struct ChildAnswer),
+		answers->nodes[0], MAX_NODES, counts, answers->n) && errno == 0;
 }
 
-void childCalcSums(int rd, int wr, int child)
+void childCalcSums(struct Connection* con, int child)
 {
-	struct CalcRequest rq;
-	struct ChildAnswer ans;
-	int bytesWritten;
-	int bytesRead;
+	struct CalcBatch batch;
+	struct AnswerBatch answers;
 	
 	attachChildToCPU(child);
 
-	while ((bytesRead = read(rd, &rq, sizeof(rq))))
+	while (childReceive(con, child, &batch))
 	{
-		if (bytesRead != sizeof(rq))
-			break;
+		long received = nowMicros();
 
-		gettimeofday(&ans.received, NULL);
-		calcSums(rq.left, rq.right, &(ans.S), &(ans.eps), &(ans.error));
-		gettimeofday(&ans.sentBack, NULL);
+		for (int i = 0; i < batch.n; i++)
+		{
+			struct ChildAnswer* ans = &answers.ans[i];
+
+			ans->sent = batch.rq[i].sent;
+			ans->received = received;
+			ans->started = nowMicros();
+			ans->axis = 0;
+			ans->nNodes = 0;
+			if (batch.rq[i].dim > 1)
+				calcBox(batch.rq[i].left, batch.rq[i].right, &batch.rq[i].box, batch.rq[i].dim, &(ans->S), &(ans->eps), &(ans->axis), &(ans->evaluations), &(ans->error));
+			else if (batch.rq[i].reuse)
+				calcNodes(batch.rq[i].left, batch.rq[i].right, batch.rq[i].nSegments, batch.known[i], batch.rq[i].nKnown,
+					answers.nodes[i], &(ans->nNodes), &(ans->S), &(ans->eps), &(ans->evaluations), &(ans->error));
+			else
+				calcSums(batch.rq[i].left, batch.rq[i].right, batch.rq[i].nSegments, &(ans->S), &(ans->eps), &(ans->evaluations), &(ans->error));
+			ans->sentBack = nowMicros();
+		}
+		answers.n = batch.n;
 
-		bytesWritten = write(wr, &ans, sizeof(ans));
-		gettimeofday(&ans.sent, NULL);
-		if (errno != 0 || bytesWritten != sizeof(ans))
+		if (!childSend(con, child, &answers))
 			break;
 	}
 }
 
-void calcSums(double left, double right, double* I, double* eps, enum ErrorCode* error)
+struct Worker
 {
-	const int nSegments = 0x1000;
-	const int nSubSegments = 0x100;
-	
-	if ((right - left) / nSegments / nSubSegments < BEST_FINENESS)
+	struct Connection con;
+	int child;
+};
+
+void* childThread(void* arg)
+{
+	struct Worker* worker = arg;
+
+	childCalcSums(&worker->con, worker->child);
+
+	if (worker->con.net != NULL)
+		netClose(worker->con.net);
+	else if (worker->con.shm == NULL)
 	{
-		*error = ERR_BEST_FINENESS_REACHED;
-		return;
+		close(worker->con.rd);
+		close(worker->con.wr);
 	}
+	free(worker);
 
-	double DI = 0;
-	double epsCur = 0;
+	return NULL;
+}
 
-	for (register int n = 0; n < nSegments; n++)
+/*
+ * Starts child i: a connection to a remote worker, or a thread or forked process
+ * that talks over pipes or its shared memory channel. Also replaces lost children.
+ * Returns false if the child could not be started.
+ */
+int startChild(struct Connection* con, int nChildren, int i, struct Options* opts)
+{
+	int childPipes[2] = {-1, -1};
+	int pipefd[2];
+	int code = 0;
+	struct ShmRegion* shm = con[i].shm;
+
+	con[i].net = NULL;
+	con[i].rd = -1;
+	con[i].wr = -1;
+	con[i].pid = -1;
+	con[i].closed = false;
+	con[i].waiting = true;
+	con[i].batch = opts->batchSize > 0 ? opts->batchSize : 1;
+	con[i].adaptiveBatch = opts->batchSize == 0;
+	con[i].computeMicros = 0;
+	con[i].answered = 0;
+
+	if (opts->connect != NULL)
 	{
-		double l = left +  n      * (right - left) / nSegments;
-		double r = left + (n + 1) * (right - left) / nSegments;
+		char endpoint[NET_ADDRESS_MAX];
 
-		register double dI = 0;
-		register double dEps = 0;
-		double fleft = f(l), fright = f(r);
-		register double f1, f2 = 0; 
-		register double x;
-	
-		/*
-		for (register int i = 1; i <= nSubSegments; i++)
+		// Connections go round the workers, so every worker gets every nth child.
+		if (!netEndpoint(opts->connect, i % netCountEndpoints(opts->connect), endpoint, sizeof(endpoint))
+			|| (con[i].net = netConnect(endpoint, opts->rule, opts->summation, con[i].samples)) == NULL)
 		{
-			f1 = f2;
-			x = l + i * (r - l) / nSubSegments;
-			f2 = f(x) - fleft - i * (fright - fleft) / nSubSegments; 
-	
-			dI += (f1 + f2) / 2;
-			dEps += f1 > f2 ? f1 - f2 : f2 - f1;
+			con[i].closed = true;
+			return false;
 		}
-		*/
 
-		double dt = 1.0 / nSubSegments;
-		for (register double t = dt; t <= 1; t += dt)
+		con[i].rd = con[i].net->fd;
+		con[i].wr = con[i].net->fd;
+		return true;
+	}
+
+	if (shm == NULL)
+	{
+		code = pipe(pipefd);
+		con[i].wr = pipefd[1];
+		childPipes[0] = pipefd[0];
+		
+		code |= pipe(pipefd);
+		con[i].rd = pipefd[0];
+		childPipes[1] = pipefd[1];
+	}
+
+	if (code != 0)
+	{
+		fprintf(stderr, "Failed to create pipes.\n");
+		con[i].closed = true;
+		return false;
+	}
+
+	if (opts->engine == ENGINE_THREAD)
+	{
+		struct Worker* worker = malloc(sizeof(struct Worker));
+		if (worker == NULL)
+			exitErrorMsg("Failed to allocate memory.\n");
+
+		worker->con = (struct Connection){.rd = childPipes[0], .wr = childPipes[1], .shm = shm};
+		worker->child = i;
+		con[i].pid = 0;
+
+		if (pthread_create(&con[i].thread, NULL, childThread, worker) != 0)
 		{
-			f1 = f2;
+			fprintf(stderr, "Failed to create new thread.\n");
+			con[i].closed = true;
+			return false;
+		}
+		return true;
+	}
 
-			x = r;
-			x -= l;
-			x *= t;
-			x += l;
+	// A replacement is forked in the middle of a run; it must not repeat buffered output.
+	fflush(NULL);
 
-			f2 = fleft;
-			f2 -= fright;
-			f2 *= t;
-			f2 -= fleft;
-			f2 += f(x);
+	if ((con[i].pid = fork()) == 0)
+	{
+		for (int j = 0; j < nChildren; j++)
+		{
+			if (con[j].rd >= 0)
+				close(con[j].rd);
+			if (con[j].wr >= 0)
+				close(con[j].wr);
+		}
 
-			dI += f1;
-			dI += f2;
+		struct Connection own = {.rd = childPipes[0], .wr = childPipes[1], .shm = shm};
+		free(con);
+		errno = 0;
 
-			dEps += f1 > f2 ? f1 - f2 : f2 - f1;
+		// The parent stops the run on ^C and then closes the channels.
+		if (opts->checkpoint != NULL)
+		{
+			signal(SIGINT, SIG_IGN);
+			signal(SIGTERM, SIG_DFL);
 		}
 
-		dI /= 2;
+		childCalcSums(&own, i);
+		destroyCPUData();
+		exit(EXIT_SUCCESS);
+	}
 
-		DI += dI / nSubSegments + (fright + fleft) / 2;
-		epsCur += dEps / nSubSegments;
+	if (shm == NULL)
+	{
+		close(childPipes[0]);
+		close(childPipes[1]);
 	}
 
-	*eps = epsCur / (nSegments);
-	*I = DI / nSegments * (right - left);
-	*error = ERR_NO_ERROR;
+	if (con[i].pid < 0)
+	{
+		fprintf(stderr, "Failed to create new child process.\n");
+		con[i].closed = true;
+		return false;
+	}
+
+	return true;
 }
 
-void createChildren(struct Connection* *conp, int nChildren)
+void createChildren(struct Connection* *conp, int nChildren, struct Options* opts)
 {
-	int childPipes[2];
-	int pipefd[2];
-	int code;
+	static double samples[INTEGRAND_SAMPLES];
+	struct ShmRegion* shm = NULL;
 
 	initCPUData();
 
 	*conp = malloc(sizeof(struct Connection) * nChildren);
-	if (conp == NULL)
+	if (*conp == NULL)
 		exitErrorMsg("Failed to allocate memory.\n");
 
 	struct Connection* con = *conp;
 
-	for (int i = 0; i < nChildren; i++)
+	// A dead child must not take the parent down with it.
+	signal(SIGPIPE, SIG_IGN);
+
+	if (opts->engine == ENGINE_PROCESS && opts->connect == NULL)
 	{
-		code = pipe(pipefd);
-		con[i].wr = pipefd[1];
-		childPipes[0] = pipefd[0];
-		
-		code = pipe(pipefd);
-		con[i].rd = pipefd[0];
-		childPipes[1] = pipefd[1];
+		struct sigaction action;
+
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = onChildExit;
+		action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigaction(SIGCHLD, &action, NULL);
+	}
+
+	if (opts->transport == TR_SHM)
+	{
+		shm = shmCreate(nChildren);
+		if (shm == NULL)
+			exitErrorMsg("Failed to map shared memory for the children.\n");
+
+		for (int i = 0; i < nChildren; i++)
+			bindToChildNode(&shm->channels[i], sizeof(struct ShmChannel), i);
+	}
 
-		con[i].closed = false;
-		con[i].waiting = true;
+	sampleIntegrand(samples);
 
-		if (code != 0)
+	for (int i = 0; i < nChildren; i++)
+	{
+		con[i].samples = samples;
+		con[i].shm = shm;
+		con[i].net = NULL;
+		con[i].rd = -1;
+		con[i].wr = -1;
+		con[i].opts = opts;
+		con[i].generation = 0;
+	}
+
+	for (int i = 0; i < nChildren; i++)
+		if (!startChild(con, nChildren, i, opts))
 		{
-			fprintf(stderr, "Failed to create pipes.\n");
+			if (opts->connect != NULL)
+				exitErrorMsg("Failed to connect to the workers.\n");
 			kill(0, SIGTERM);
 		}
+}
 
-		if (fork() == 0)
-		{
-			int child = i;
-			for (; i >= 0; i--) {
+void destroyChildren(struct Connection* con, int nChildren)
+{
+	struct ShmRegion* shm = con[0].shm;
+
+	if (shm != NULL)
+		shmShutdown(shm);
+	else
+		for (int i = 0; i < nChildren; i++)
+			if (con[i].net != NULL)
+				netClose(con[i].net);
+			else
+			{
 				close(con[i].rd);
 				close(con[i].wr);
 			}
-			free(con);
+	
+	for (int i = 0; i < nChildren; i++)
+		if (con[i].pid > 0)
+			waitpid(con[i].pid, NULL, 0);
+		else if (con[i].pid == 0)
+			pthread_join(con[i].thread, NULL);
+	free(con);
 
-			childCalcSums(childPipes[0], childPipes[1], child);
-			exit(EXIT_SUCCESS);
-		}
-		
-		if (errno != 0)
-		{
-			fprintf(stderr, "Failed to create new child process.\n");
-			kill(0, SIGTERM);
-		}
-		close(childPipes[0]);
-		close(childPipes[1]);
-	}
+	if (shm != NULL)
+		shmDestroy(shm);
+	destroyCPUData();
 }
 
-void destroyChildren(struct Connection* con, int nChildren)
+/*
+ * Serves coordinators until killed. Every connection is a child thread of its
+ * own, pinned like the children of a local run.
+ */
+void runWorker(struct Options* opts)
 {
-	for (int i = 0; i < nChildren; i++)
+	double samples[INTEGRAND_SAMPLES];
+	int listenFd = netListen(opts->worker);
+	if (listenFd < 0)
+		exitErrorMsg("Failed to listen on the worker address.\n");
+
+	sampleIntegrand(samples);
+
+	initCPUData();
+	fprintf(stderr, "Worker listening on %s\n", opts->worker);
+
+	for (int child = 0; ; child++)
 	{
-		close(con[i].rd);
-		close(con[i].wr);
+		struct NetPeer* peer = netAccept(listenFd, opts->rule, opts->summation, samples);
+		pthread_t thread;
+
+		if (peer == NULL)
+			continue;
+
+		struct Worker* worker = malloc(sizeof(struct Worker));
+		if (worker == NULL)
+			exitErrorMsg("Failed to allocate memory.\n");
+
+		worker->con = (struct Connection){.rd = peer->fd, .wr = peer->fd, .net = peer};
+		worker->child = child;
+		netStartHeartbeat(peer);
+
+		if (pthread_create(&thread, NULL, childThread, worker) != 0)
+		{
+			fprintf(stderr, "Failed to create new thread.\n");
+			netClose(peer);
+			free(worker);
+			continue;
+		}
+		pthread_detach(thread);
 	}
-	free(con);
-	
-	for (int i = 0; i < nChildren; i++)
-		wait(NULL);
 }
-
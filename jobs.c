@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "jobs.h"
+#include "cubature.h"
+
+static void initQueue(struct JobQueue* queue, int size)
+{
+	queue->jobs = calloc(size, sizeof(struct Job));
+	if (queue->jobs == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for jobs.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	queue->size = size;
+	queue->nActive = 0;
+	queue->line = 0;
+}
+
+static void initJob(struct Job* job, long id, double left, double right, double maxDeviation)
+{
+	memset(job, 0, sizeof(*job));
+	job->id = id;
+	job->left = left;
+	job->right = right;
+	job->maxDeviation = maxDeviation;
+	job->dens = maxDeviation / (right - left);
+	job->dim = 1;
+	unitBox(&job->box);
+	job->error = ERR_NO_ERROR;
+}
+
+void initSingleJob(struct JobQueue* queue, double left, double right, const struct Box* box, int dim, double maxDeviation)
+{
+	initQueue(queue, 1);
+	queue->in = NULL;
+	queue->exhausted = false;
+
+	initJob(&queue->single, 0, left, right, maxDeviation);
+	queue->single.dim = dim;
+	queue->single.box = *box;
+	queue->single.dens = maxDeviation / boxVolume(left, right, box);
+}
+
+/*
+ * Path "-" reads the jobs from stdin.
+ */
+int openJobs(struct JobQueue* queue, const char* path, int size)
+{
+	queue->in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (queue->in == NULL)
+	{
+		fprintf(stderr, "Failed to open %s.\n", path);
+		return false;
+	}
+
+	initQueue(queue, size);
+	queue->exhausted = false;
+
+	return true;
+}
+
+/*
+ * Reads the next job: "left right [maxDeviation]" per line. Blank lines and
+ * lines starting with '#' are skipped, malformed ones are reported and skipped.
+ * Returns false at the end of the input.
+ */
+int readJob(struct JobQueue* queue, struct Job* job)
+{
+	char line[JOB_LINE_MAX];
+
+	if (queue->in == NULL && !queue->exhausted)
+	{
+		*job = queue->single;
+		queue->exhausted = true;
+		return true;
+	}
+
+	while (!queue->exhausted && queue->in != NULL && fgets(line, sizeof(line), queue->in) != NULL)
+	{
+		double left, right, maxDeviation = 0.000001;
+		char extra;
+
+		queue->line++;
+
+		char* p = line + strspn(line, " \t\r\n");
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		int n = sscanf(p, "%lf %lf %lf %c", &left, &right, &maxDeviation, &extra);
+		// Jobs take no transform, so their bounds must be finite.
+		if (n < 2 || n > 3 || !isfinite(left) || !isfinite(right) || !isfinite(maxDeviation)
+			|| !(left < right) || !(maxDeviation > 0))
+		{
+			fprintf(stderr, "Skipping job on line %ld: expected 'left right [maxDeviation]', finite, with left < right.\n",
+				queue->line);
+			continue;
+		}
+
+		initJob(job, queue->line, left, right, maxDeviation);
+		return true;
+	}
+
+	queue->exhausted = true;
+	return false;
+}
+
+/*
+ * Adds an accepted segment, or the box [left, ...] x box, to the job's I. With
+ * compensated summation it is also kept for completeJob().
+ */
+void acceptSegment(struct Job* job, double left, const struct Box* box, double S)
+{
+	if (!compensatedSummation())
+	{
+		job->I += S;
+		return;
+	}
+
+	sumAdd(&job->sum, S);
+	job->I = sumValue(job->sum);
+	double corner[MAX_DIM];
+
+	corner[0] = left;
+	memcpy(corner + 1, box->lower, (job->dim - 1) * sizeof(double));
+	contributionsAdd(&job->accepted, corner, job->dim, S);
+}
+
+/*
+ * With compensated summation, replaces the running I with the sum of the
+ * accepted segments in the order of their lower corners, which is the same
+ * in every run.
+ */
+void completeJob(struct Job* job)
+{
+	if (compensatedSummation())
+		job->I = contributionsSum(&job->accepted);
+	contributionsFree(&job->accepted);
+}
+
+void closeJobs(struct JobQueue* queue)
+{
+	if (queue->in != NULL && queue->in != stdin)
+		fclose(queue->in);
+	for (int i = 0; i < queue->size; i++)
+		contributionsFree(&queue->jobs[i].accepted);
+	free(queue->jobs);
+}
@@ -0,0 +1,64 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+
+#include "general.h"
+#include "sum.h"
+
+// In batch mode up to this many jobs per child share the segment list.
+#define JOBS_PER_CHILD 4
+#define JOB_LINE_MAX 0x100
+
+struct Job
+{
+	long id;			// line of the job in the input, 0 for the job given in argv
+	double left;
+	double right;
+	double maxDeviation;
+	double dens;		// allowed error per unit of width or volume
+	int dim;
+	struct Box box;		// axes past the first of a box
+
+	double I;
+	double errorSpent;
+	struct CompensatedSum sum;
+	struct Contributions accepted;	// kept with compensated summation only
+	int pending;		// segments of the job still in the list
+
+	// Global adaptation: sum of err over the evaluated segments, in units of maxDeviation,
+	// and how many segments have not been evaluated yet.
+	double errorEstimate;
+	int evaluating;
+
+	int active;
+	enum ErrorCode error;
+};
+
+/*
+ * Jobs of one run. A single integral from argv is a queue of one job without
+ * an input; in batch mode jobs are read on demand, so the input may be a pipe.
+ */
+struct JobQueue
+{
+	FILE* in;
+	long line;
+	int exhausted;
+
+	struct Job single;	// handed out once when there is no input
+
+	struct Job* jobs;
+	int size;
+	int nActive;
+	int global;			// ADAPT_GLOBAL
+	int reuse;			// --reuse
+};
+
+void initSingleJob(struct JobQueue* queue, double left, double right, const struct Box* box, int dim, double maxDeviation);
+int openJobs(struct JobQueue* queue, const char* path, int size);
+int readJob(struct JobQueue* queue, struct Job* job);
+void acceptSegment(struct Job* job, double left, const struct Box* box, double S);
+void completeJob(struct Job* job);
+void closeJobs(struct JobQueue* queue);
+
+#endif
@@ -0,0 +1,946 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <float.h>
+
+#include "kernel.h"
+#include "sum.h"
+#include "cubature.h"
+
+static inline double f(double x)
+{
+	return FUNCTION(x);
+}
+
+static Integrand userFunc = NULL;
+static IntegrandV userFuncV = NULL;
+static IntegrandN userFuncN = NULL;
+static int userLoaded = false;
+
+/*
+ * Replaces the built-in integrand with 'func' (and 'func_v' if present) from a shared library,
+ * and the one of boxes with 'func_nd'. The library needs at least one of 'func' and 'func_nd'.
+ * Must run before the children are created. Returns false and reports the reason on failure.
+ */
+int loadFunction(const char* path)
+{
+	void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (lib == NULL)
+	{
+		fprintf(stderr, "Failed to load %s: %s\n", path, dlerror());
+		return false;
+	}
+
+	*(void**)(&userFunc) = dlsym(lib, "func");
+	*(void**)(&userFuncV) = dlsym(lib, "func_v");
+	*(void**)(&userFuncN) = dlsym(lib, "func_nd");
+
+	if (userFunc == NULL && userFuncN == NULL)
+	{
+		fprintf(stderr, "%s defines neither 'double func(double x)' nor 'double func_nd(const double* x, int dim)'.\n", path);
+		dlclose(lib);
+		userFuncV = NULL;
+		return false;
+	}
+
+	userLoaded = true;
+	return true;
+}
+
+/*
+ * Whether the integrand is defined for dim dimensions.
+ */
+int supportsDimension(int dim)
+{
+	if (dim < 1 || dim > MAX_DIM)
+		return false;
+	if (!userLoaded)
+		return true;
+
+	return dim == 1 ? userFunc != NULL : userFuncN != NULL;
+}
+
+double evaluatePoint(const double* x, int dim)
+{
+	if (userFuncN != NULL)
+		return userFuncN(x, dim);
+
+	double y = 1;
+	for (int i = 0; i < dim; i++)
+		y *= f(x[i]);
+	return y;
+}
+
+static void evaluateAt(const double* x, double* y, size_t n)
+{
+	if (!userLoaded)
+		for (size_t i = 0; i < n; i++)
+			y[i] = f(x[i]);
+	else if (userFuncV != NULL)
+		userFuncV(x, y, n);
+	else
+		for (size_t i = 0; i < n; i++)
+			y[i] = userFunc(x[i]);
+}
+
+// Off any grid and on both sides of 0, so that integrands defined only for x > 0 differ too.
+static const double samplePoints[] = {0.3, 0.7, 1.9, -0.6, 12.5};
+static const double samplePoint[MAX_DIM] = {0.37, 0.61, 0.23, 0.89, 0.41, 0.53};
+static const int sampleDims[] = {2, 3, MAX_DIM};
+
+void sampleIntegrand(double* samples)
+{
+	const int n = sizeof(samplePoints) / sizeof(samplePoints[0]);
+
+	if (supportsDimension(1))
+		evaluateAt(samplePoints, samples, n);
+	else
+		for (int i = 0; i < n; i++)
+			samples[i] = NAN;
+
+	for (int i = 0; i < INTEGRAND_SAMPLES - n; i++)
+		samples[n + i] = supportsDimension(sampleDims[i]) ? evaluatePoint(samplePoint, sampleDims[i]) : NAN;
+
+	errno = 0;
+}
+
+int sameIntegrand(const double* samples, const double* other)
+{
+	for (int i = 0; i < INTEGRAND_SAMPLES; i++)
+	{
+		double a = samples[i], b = other[i];
+
+		if (isnan(a) || isnan(b))
+		{
+			if (isnan(a) != isnan(b))
+				return false;
+		}
+		else if (a != b && (isinf(a) || isinf(b) || fabs(a - b) > INTEGRAND_TOLERANCE * fmax(fabs(a), fabs(b))))
+			return false;
+	}
+
+	return true;
+}
+
+static enum Transform transform = TRANSFORM_NONE;
+static double transformLeft, transformRight;
+
+/*
+ * x(t) and dx/dt of the transform. The parent integrates f(x(t)) x'(t) over t.
+ * The rational transform takes the infinite end as the last t short of it, where
+ * f(x) x'(t) has about reached its limit.
+ */
+static void transformPoint(double t, double* x, double* dx)
+{
+	double a = transformLeft, b = transformRight;
+
+	if (transform == TRANSFORM_TANH_SINH)
+	{
+		// Measured from the nearer end, so that points next to a singularity stay apart from it.
+		double u = M_PI_2 * sinh(t);
+		double e = exp(-2 * fabs(u));
+		double offset = (b - a) * e / (1 + e);
+
+		*x = u < 0 ? a + offset : b - offset;
+		*dx = (b - a) * M_PI * cosh(t) * e / ((1 + e) * (1 + e));
+	}
+	else if (isinf(a) && isinf(b))
+	{
+		t = fmax(-RATIONAL_LIMIT, fmin(t, RATIONAL_LIMIT));
+		*x = t / (1 - t * t);
+		*dx = (1 + t * t) / ((1 - t * t) * (1 - t * t));
+	}
+	else if (isinf(b))
+	{
+		t = fmin(t, RATIONAL_LIMIT);
+		*x = a + t / (1 - t);
+		*dx = 1 / ((1 - t) * (1 - t));
+	}
+	else
+	{
+		t = fmax(-RATIONAL_LIMIT, t);
+		*x = b + t / (1 + t);
+		*dx = 1 / ((1 + t) * (1 + t));
+	}
+}
+
+/*
+ * Evaluates the integrand at the points t of the transformed interval. Points
+ * of tanh-sinh that round to an end of [left, right], where f may be infinite,
+ * count as 0.
+ */
+static void evaluate(const double* t, double* y, size_t n)
+{
+	if (transform == TRANSFORM_NONE)
+	{
+		evaluateAt(t, y, n);
+		return;
+	}
+
+	double x[N_SUBSEGMENTS], dx[N_SUBSEGMENTS], values[N_SUBSEGMENTS];
+	size_t at[N_SUBSEGMENTS];
+
+	for (size_t done = 0; done < n; done += N_SUBSEGMENTS)
+	{
+		size_t chunk = n - done < N_SUBSEGMENTS ? n - done : N_SUBSEGMENTS;
+		size_t m = 0;
+
+		for (size_t i = done; i < done + chunk; i++)
+		{
+			y[i] = 0;
+			transformPoint(t[i], &x[m], &dx[m]);
+			if (dx[m] > 0 && isfinite(dx[m])
+				&& (transform != TRANSFORM_TANH_SINH || (x[m] > transformLeft && x[m] < transformRight)))
+				at[m++] = i;
+		}
+
+		evaluateAt(x, values, m);
+		for (size_t k = 0; k < m; k++)
+			y[at[k]] = values[k] * dx[k];
+	}
+
+	// Far out f and the transform underflow by design; a child must not take that for an error.
+	errno = 0;
+}
+
+/*
+ * Integrates the residual of linear interpolation over [l, r].
+ * Stores the sum of trapezoid heights in *dI and the total variation of the residual in *dEps.
+ */
+typedef void (*SegmentKernel)(double l, double r, double fleft, double fright, double* dI, double* dEps);
+
+static void segmentScalar(double l, double r, double fleft, double fright, double* dIp, double* dEpsp)
+{
+	register double dI = 0;
+	register double dEps = 0;
+	register double f1, f2 = 0;
+	register double x;
+	struct CompensatedSum sumI = {0, 0}, sumEps = {0, 0};
+	int compensated = compensatedSummation();
+
+	double dt = 1.0 / N_SUBSEGMENTS;
+	for (register double t = dt; t <= 1; t += dt)
+	{
+		f1 = f2;
+
+		x = r;
+		x -= l;
+		x *= t;
+		x += l;
+
+		f2 = fleft;
+		f2 -= fright;
+		f2 *= t;
+		f2 -= fleft;
+		f2 += f(x);
+
+		if (compensated)
+		{
+			sumAdd(&sumI, f1 + f2);
+			sumAdd(&sumEps, f1 > f2 ? f1 - f2 : f2 - f1);
+			continue;
+		}
+
+		dI += f1;
+		dI += f2;
+
+		dEps += f1 > f2 ? f1 - f2 : f2 - f1;
+	}
+
+	if (compensated)
+	{
+		dI = sumValue(sumI);
+		dEps = sumValue(sumEps);
+	}
+
+	*dIp = dI / 2;
+	*dEpsp = dEps;
+}
+
+/*
+ * Same sums as segmentScalar() for integrand values computed beforehand:
+ * y[i] = f(l + (r - l) * (i + 1) / N_SUBSEGMENTS).
+ */
+static void segmentValues(double fleft, double fright, const double* y, double* dI, double* dEps)
+{
+	double res[N_SUBSEGMENTS + 1];
+	double dt = 1.0 / N_SUBSEGMENTS;
+
+	// A double counter: converting i on every iteration would serialise the loop on cvtsi2sd.
+	double k = 1;
+	res[0] = 0;
+	for (int i = 1; i <= N_SUBSEGMENTS; i++, k++)
+		res[i] = (fleft - fright) * (k * dt) - fleft + y[i - 1];
+
+	if (compensatedSummation())
+	{
+		struct CompensatedSum sumI = {0, 0}, sumEps = {0, 0};
+		for (int i = 1; i <= N_SUBSEGMENTS; i++)
+		{
+			sumAdd(&sumI, res[i - 1] + res[i]);
+			sumAdd(&sumEps, fabs(res[i] - res[i - 1]));
+		}
+
+		*dI = sumValue(sumI) / 2;
+		*dEps = sumValue(sumEps);
+		return;
+	}
+
+	double sumI = 0;
+	double sumEps = 0;
+	for (int i = 1; i <= N_SUBSEGMENTS; i++)
+	{
+		sumI += res[i - 1] + res[i];
+		sumEps += fabs(res[i] - res[i - 1]);
+	}
+
+	*dI = sumI / 2;
+	*dEps = sumEps;
+}
+
+/*
+ * Trapezoids over the nodes x[0..N_SUBSEGMENTS] of a piece that is past
+ * BEST_FINENESS, with y[k] = f(x[k]). Every trapezoid takes the width x[k + 1] - x[k]
+ * its nodes actually have, which is exact, and twice its area is added up in
+ * double-double into *dI. *dEps is the variation of the residual of linear
+ * interpolation, as in segmentScalar().
+ */
+typedef void (*PreciseKernel)(const double* x, const double* y, struct DoubleDouble* dI, double* dEps);
+
+static void preciseScalar(const double* x, const double* y, struct DoubleDouble* dI, double* dEps)
+{
+	double slope = (y[N_SUBSEGMENTS] - y[0]) / (x[N_SUBSEGMENTS] - x[0]);
+	struct DoubleDouble sum = {0, 0};
+	double variation = 0;
+
+	for (int k = 0; k < N_SUBSEGMENTS; k++)
+	{
+		struct DoubleDouble pair = twoSum(y[k], y[k + 1]);
+		double width = x[k + 1] - x[k];
+		struct DoubleDouble area = twoProduct(width, pair.hi);
+
+		area.lo += width * pair.lo;
+		ddAdd(&sum, area);
+
+		double res1 = y[k] - y[0] - slope * (x[k] - x[0]);
+		double res2 = y[k + 1] - y[0] - slope * (x[k + 1] - x[0]);
+		variation += fabs(res2 - res1);
+	}
+
+	*dI = sum;
+	*dEps = variation;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef double v4d __attribute__((vector_size(32)));
+typedef double v4du __attribute__((vector_size(32), aligned(8)));
+typedef long long v4l __attribute__((vector_size(32)));
+
+typedef double v8d __attribute__((vector_size(64)));
+typedef double v8du __attribute__((vector_size(64), aligned(8)));
+typedef long long v8l __attribute__((vector_size(64)));
+
+#define SIGN_MASK 0x7fffffffffffffffLL
+
+/*
+ * sumAdd() on every lane: the lanes of c take what the lanes of sum lose.
+ */
+#define VECTOR_SUM_ADD(vec, ivec, sum, c, x)                                          \
+{                                                                                     \
+	vec t = sum + x;                                                                  \
+	ivec larger = (vec)((ivec)sum & SIGN_MASK) >= (vec)((ivec)x & SIGN_MASK);         \
+	c += (vec)((larger & (ivec)((sum - t) + x)) | (~larger & (ivec)((x - t) + sum))); \
+	sum = t;                                                                          \
+}
+
+/*
+ * Vector version of segmentScalar(). The residual is first evaluated for all
+ * subsegment points, W at a time, into res[]. The second pass then reads the
+ * left and right endpoints of each subsegment from res[] independently, so no
+ * lane waits for the previous one. Every residual is bitwise equal to the
+ * scalar one; only the order of the final additions differs.
+ */
+#define VECTOR_KERNEL(name, isa, W, vec, vecu, ivec, ...)                             \
+__attribute__((target(isa)))                                                          \
+static void name(double l, double r, double fleft, double fright, double* dI, double* dEps) \
+{                                                                                     \
+	double res[W + N_SUBSEGMENTS] __attribute__((aligned(sizeof(vec))));              \
+	vec k = __VA_ARGS__;                                                              \
+	double dt = 1.0 / N_SUBSEGMENTS;                                                  \
+                                                                                      \
+	for (int i = 0; i < N_SUBSEGMENTS; i += W, k += W)                                \
+	{                                                                                 \
+		vec t = k * dt;                                                               \
+		vec x = (r - l) * t + l;                                                      \
+		*(vec*)(res + W + i) = (fleft - fright) * t - fleft + FUNCTION(x);            \
+	}                                                                                 \
+                                                                                      \
+	vec sumI = {0};                                                                   \
+	vec sumEps = {0};                                                                 \
+	vec cI = {0};                                                                     \
+	vec cEps = {0};                                                                   \
+	res[W - 1] = 0;                                                                   \
+                                                                                      \
+	if (compensatedSummation())                                                       \
+		for (int i = 0; i < N_SUBSEGMENTS; i += W)                                    \
+		{                                                                             \
+			vec f1 = *(vecu*)(res + W - 1 + i);                                       \
+			vec f2 = *(vec*)(res + W + i);                                            \
+			vec pair = f1 + f2;                                                       \
+			vec variation = (vec)((ivec)(f2 - f1) & SIGN_MASK);                       \
+                                                                                      \
+			VECTOR_SUM_ADD(vec, ivec, sumI, cI, pair)                                 \
+			VECTOR_SUM_ADD(vec, ivec, sumEps, cEps, variation)                        \
+		}                                                                             \
+	else                                                                              \
+		for (int i = 0; i < N_SUBSEGMENTS; i += W)                                    \
+		{                                                                             \
+			vec f1 = *(vecu*)(res + W - 1 + i);                                       \
+			vec f2 = *(vec*)(res + W + i);                                            \
+                                                                                      \
+			sumI += f1 + f2;                                                          \
+			sumEps += (vec)((ivec)(f2 - f1) & SIGN_MASK);                             \
+		}                                                                             \
+                                                                                      \
+	/* The compensations stay zero in plain mode. */                                  \
+	struct CompensatedSum totalI = {0, 0}, totalEps = {0, 0};                         \
+	for (int k = 0; k < W; k++)                                                       \
+	{                                                                                 \
+		sumAdd(&totalI, sumI[k]);                                                     \
+		sumAdd(&totalI, cI[k]);                                                       \
+		sumAdd(&totalEps, sumEps[k]);                                                 \
+		sumAdd(&totalEps, cEps[k]);                                                   \
+	}                                                                                 \
+	*dI = (compensatedSummation() ? sumValue(totalI) : totalI.sum) / 2;               \
+	*dEps = compensatedSummation() ? sumValue(totalEps) : totalEps.sum;               \
+	__builtin_ia32_vzeroupper();                                                      \
+}
+
+VECTOR_KERNEL(segmentAVX2, "avx2", 4, v4d, v4du, v4l, {1, 2, 3, 4})
+VECTOR_KERNEL(segmentAVX512, "avx512f", 8, v8d, v8du, v8l, {1, 2, 3, 4, 5, 6, 7, 8})
+
+/*
+ * Vector version of preciseScalar(): twoSum(), twoProduct() and the addition to
+ * the sum on every lane, with the lanes' sums kept apart until the end. Every
+ * trapezoid depends only on its own nodes, so no lane waits for another.
+ */
+#define PRECISE_KERNEL(name, isa, W, vec, vecu, ivec)                                  \
+__attribute__((target(isa)))                                                          \
+static void name(const double* x, const double* y, struct DoubleDouble* dI, double* dEps) \
+{                                                                                     \
+	double slope = (y[N_SUBSEGMENTS] - y[0]) / (x[N_SUBSEGMENTS] - x[0]);             \
+	vec hi = {0}, lo = {0}, variation = {0};                                          \
+                                                                                      \
+	for (int k = 0; k < N_SUBSEGMENTS; k += W)                                        \
+	{                                                                                 \
+		vec x1 = *(vecu*)(x + k), x2 = *(vecu*)(x + k + 1);                           \
+		vec y1 = *(vecu*)(y + k), y2 = *(vecu*)(y + k + 1);                           \
+		vec width = x2 - x1;                                                          \
+                                                                                      \
+		vec pair = y1 + y2;                                                           \
+		vec bb = pair - y1;                                                           \
+		vec pairLo = (y1 - (pair - bb)) + (y2 - bb);                                  \
+                                                                                      \
+		vec area = width * pair;                                                      \
+		vec cw = DEKKER_SPLITTER * width, cp = DEKKER_SPLITTER * pair;                \
+		vec wh = cw - (cw - width), ph = cp - (cp - pair);                            \
+		vec wl = width - wh, pl = pair - ph;                                          \
+		vec areaLo = ((wh * ph - area) + wh * pl + wl * ph) + wl * pl + width * pairLo; \
+                                                                                      \
+		vec t = hi + area;                                                            \
+		bb = t - hi;                                                                  \
+		lo += ((hi - (t - bb)) + (area - bb)) + areaLo;                               \
+		hi = t;                                                                       \
+                                                                                      \
+		vec res1 = y1 - y[0] - slope * (x1 - x[0]);                                   \
+		vec res2 = y2 - y[0] - slope * (x2 - x[0]);                                   \
+		variation += (vec)((ivec)(res2 - res1) & SIGN_MASK);                          \
+	}                                                                                 \
+                                                                                      \
+	struct DoubleDouble sum = {0, 0};                                                 \
+	double total = 0;                                                                 \
+	for (int k = 0; k < W; k++)                                                       \
+	{                                                                                 \
+		ddAdd(&sum, (struct DoubleDouble){hi[k], lo[k]});                             \
+		total += variation[k];                                                        \
+	}                                                                                 \
+	*dI = sum;                                                                        \
+	*dEps = total;                                                                    \
+	__builtin_ia32_vzeroupper();                                                      \
+}
+
+PRECISE_KERNEL(preciseAVX2, "avx2", 4, v4d, v4du, v4l)
+PRECISE_KERNEL(preciseAVX512, "avx512f", 8, v8d, v8du, v8l)
+
+#endif
+
+static SegmentKernel segmentKernel = segmentScalar;
+static PreciseKernel preciseKernel = preciseScalar;
+static const char* segmentKernelName = "scalar";
+
+/*
+ * Picks the widest kernel the CPU supports, or the one asked for if it is available.
+ * Must run before the children are created so that they inherit the choice.
+ */
+void selectKernel(enum KernelImpl impl)
+{
+	segmentKernel = segmentScalar;
+	preciseKernel = preciseScalar;
+	segmentKernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	int avx512 = __builtin_cpu_supports("avx512f");
+	int avx2 = __builtin_cpu_supports("avx2");
+
+	if ((impl == KERNEL_AVX512 && !avx512) || (impl == KERNEL_AVX2 && !avx2))
+	{
+		fprintf(stderr, "Requested kernel is not supported by this CPU, using the best available one.\n");
+		impl = KERNEL_AUTO;
+	}
+
+	if (impl == KERNEL_AUTO)
+		impl = avx512 ? KERNEL_AVX512 : (avx2 ? KERNEL_AVX2 : KERNEL_SCALAR);
+
+	if (impl == KERNEL_AVX512)
+	{
+		segmentKernel = segmentAVX512;
+		preciseKernel = preciseAVX512;
+		segmentKernelName = "avx512";
+	}
+	else if (impl == KERNEL_AVX2)
+	{
+		segmentKernel = segmentAVX2;
+		preciseKernel = preciseAVX2;
+		segmentKernelName = "avx2";
+	}
+#else
+	if (impl != KERNEL_AUTO && impl != KERNEL_SCALAR)
+		fprintf(stderr, "SIMD kernels are only built for x86, using the scalar one.\n");
+#endif
+}
+
+const char* kernelName()
+{
+	return segmentKernelName;
+}
+
+/*
+ * The original rule: trapezoids over nSegments x N_SUBSEGMENTS points. eps is the
+ * mean absolute variation of the residual of linear interpolation.
+ */
+static void sumsTrapezoid(double left, double right, int nSegments, double* I, double* eps)
+{
+	const int nSubSegments = N_SUBSEGMENTS;
+
+	double DI = 0;
+	double epsCur = 0;
+	struct CompensatedSum sumDI = {0, 0}, sumEps = {0, 0};
+
+	for (register int n = 0; n < nSegments; n++)
+	{
+		double l = left +  n      * (right - left) / nSegments;
+		double r = left + (n + 1) * (right - left) / nSegments;
+
+		double dI, dEps;
+		double fleft, fright;
+
+		if (!userLoaded && transform == TRANSFORM_NONE)
+		{
+			fleft = f(l);
+			fright = f(r);
+			segmentKernel(l, r, fleft, fright, &dI, &dEps);
+		}
+		else
+		{
+			// One call of the loaded integrand per segment: both ends, then the subsegment points.
+			double x[N_SUBSEGMENTS + 2], y[N_SUBSEGMENTS + 2];
+			double dt = 1.0 / N_SUBSEGMENTS;
+
+			double k = 1;
+			x[0] = l;
+			x[1] = r;
+			for (int i = 1; i <= N_SUBSEGMENTS; i++, k++)
+				x[i + 1] = (r - l) * (k * dt) + l;
+
+			evaluate(x, y, N_SUBSEGMENTS + 2);
+			fleft = y[0];
+			fright = y[1];
+			segmentValues(fleft, fright, y + 2, &dI, &dEps);
+		}
+
+		if (compensatedSummation())
+		{
+			sumAdd(&sumDI, dI / nSubSegments + (fright + fleft) / 2);
+			sumAdd(&sumEps, dEps / nSubSegments);
+			continue;
+		}
+
+		DI += dI / nSubSegments + (fright + fleft) / 2;
+		epsCur += dEps / nSubSegments;
+	}
+
+	if (compensatedSummation())
+	{
+		DI = sumValue(sumDI);
+		epsCur = sumValue(sumEps);
+	}
+
+	*eps = epsCur / (nSegments);
+	*I = DI / nSegments * (right - left);
+}
+
+/*
+ * sumsTrapezoid() for segments past BEST_FINENESS. The nodes of a piece are
+ * computed in double as before, but the trapezoids take their actual widths and
+ * the sums are kept in double-double, so the rounding of x no longer shows in I.
+ */
+static void sumsTrapezoidPrecise(double left, double right, int nSegments, double* I, double* eps)
+{
+	double x[N_SUBSEGMENTS + 1], y[N_SUBSEGMENTS + 1];
+	struct DoubleDouble total = {0, 0};
+	double epsCur = 0;
+
+	for (int n = 0; n < nSegments; n++)
+	{
+		double l = left +  n      * (right - left) / nSegments;
+		double r = left + (n + 1) * (right - left) / nSegments;
+		double dt = 1.0 / N_SUBSEGMENTS;
+
+		double k = 1;
+		x[0] = l;
+		for (int i = 1; i < N_SUBSEGMENTS; i++, k++)
+			x[i] = (r - l) * (k * dt) + l;
+		x[N_SUBSEGMENTS] = r;
+
+		struct DoubleDouble dI;
+		double dEps;
+
+		evaluate(x, y, N_SUBSEGMENTS + 1);
+		preciseKernel(x, y, &dI, &dEps);
+
+		ddAdd(&total, dI);
+		epsCur += dEps / N_SUBSEGMENTS;
+	}
+
+	*eps = epsCur / nSegments;
+	*I = (total.hi + total.lo) / 2;
+}
+
+/*
+ * 15-point Kronrod rule with its embedded 7-point Gauss rule. Nodes are given for [-1, 1],
+ * positive half only; the Gauss nodes are the odd ones. The difference of the two
+ * results is the error estimate.
+ */
+static const double gkNodes[8] = {
+	0.991455371120812639206854697526329,
+	0.949107912342758524526189684047851,
+	0.864864423359769072789712788640926,
+	0.741531185599394439863864773280788,
+	0.586087235467691130294144845693013,
+	0.405845151377397166906606412076961,
+	0.207784955007898467600689403773245,
+	0.000000000000000000000000000000000
+};
+
+static const double kronrodWeights[8] = {
+	0.022935322010529224963732008058970,
+	0.063092092629978553290700663189204,
+	0.104790010322250183839876322541518,
+	0.140653259715525918745189590510238,
+	0.169004726639267902826583426598550,
+	0.190350578064785409913256402421014,
+	0.204432940075298892414161999234649,
+	0.209482141084727828012999174891714
+};
+
+static const double gaussWeights[4] = {
+	0.129484966168869693270611432679082,
+	0.279705391489276667901467771423780,
+	0.381830050505118944950369775488975,
+	0.417959183673469387755102040816327
+};
+
+static void sumsGaussKronrod(double left, double right, int nSegments, double* I, double* eps)
+{
+	(void)nSegments;
+	double center = (left + right) / 2;
+	double half = (right - left) / 2;
+	double x[15], y[15];
+
+	for (int i = 0; i < 7; i++)
+	{
+		x[2 * i] = center - half * gkNodes[i];
+		x[2 * i + 1] = center + half * gkNodes[i];
+	}
+	x[14] = center;
+
+	evaluate(x, y, 15);
+
+	double kronrod = kronrodWeights[7] * y[14];
+	double gauss = gaussWeights[3] * y[14];
+
+	for (int i = 0; i < 7; i++)
+	{
+		kronrod += kronrodWeights[i] * (y[2 * i] + y[2 * i + 1]);
+		if (i % 2 == 1)
+			gauss += gaussWeights[i / 2] * (y[2 * i] + y[2 * i + 1]);
+	}
+
+	*I = kronrod * half;
+	*eps = fabs(kronrod - gauss) / 2;
+}
+
+/*
+ * Nested rules take y[i] = f(left + (right - left) * i / (nodes - 1)). The first
+ * nKnown values, those at the even nodes, are given; only the others are evaluated.
+ */
+static void evaluateNodes(double left, double right, int nodes, int nKnown, double* y)
+{
+	double x[MAX_NODES], values[MAX_NODES];
+	int step = nKnown > 0 ? 2 : 1;
+	int n = 0;
+
+	for (int i = step - 1; i < nodes; i += step)
+		x[n++] = left + (right - left) * i / (nodes - 1);
+
+	evaluate(x, values, n);
+
+	if (nKnown == 0)
+	{
+		memcpy(y, values, nodes * sizeof(double));
+		return;
+	}
+
+	// From the right, so that no known value is overwritten before it moves.
+	for (int i = nodes - 1; i >= 0; i--)
+		y[i] = i % 2 ? values[i / 2] : y[i / 2];
+}
+
+/*
+ * One step of adaptive Simpson: the rule on the whole segment and on its halves.
+ * Their difference estimates the error; the parent splitting refused segments
+ * does the recursion.
+ */
+static void nestedSimpson(double left, double right, const double* y, double* I, double* eps)
+{
+	double whole = (y[0] + 4 * y[2] + y[4]) / 6;
+	double halves = (y[0] + 4 * y[1] + 2 * y[2] + 4 * y[3] + y[4]) / 12;
+
+	*I = (halves + (halves - whole) / 15) * (right - left);
+	*eps = fabs(halves - whole) / 15;
+}
+
+/*
+ * Romberg extrapolation of trapezoids with 1, 2, ... 2^(ROMBERG_LEVELS - 1) intervals.
+ * The last two diagonal entries give the error estimate.
+ */
+static void nestedRomberg(double left, double right, const double* y, double* I, double* eps)
+{
+	const int nPoints = (1 << (ROMBERG_LEVELS - 1)) + 1;
+	double R[ROMBERG_LEVELS][ROMBERG_LEVELS];
+
+	for (int level = 0, step = nPoints - 1; level < ROMBERG_LEVELS; level++, step /= 2)
+	{
+		double sum = (y[0] + y[nPoints - 1]) / 2;
+		for (int i = step; i < nPoints - 1; i += step)
+			sum += y[i];
+		R[level][0] = sum * step / (nPoints - 1);
+
+		double factor = 4;
+		for (int k = 1; k <= level; k++, factor *= 4)
+			R[level][k] = R[level][k - 1] + (R[level][k - 1] - R[level - 1][k - 1]) / (factor - 1);
+	}
+
+	*I = R[ROMBERG_LEVELS - 1][ROMBERG_LEVELS - 1] * (right - left);
+	*eps = fabs(R[ROMBERG_LEVELS - 1][ROMBERG_LEVELS - 1] - R[ROMBERG_LEVELS - 2][ROMBERG_LEVELS - 2]);
+}
+
+/*
+ * Every rule returns the integral over [left, right] in *I and its error estimate
+ * per unit of length in *eps, which the parent compares with dens. Only the
+ * trapezoid rule is sampled in nSegments pieces; the counts below are per piece.
+ * Nested rules compute from the values at their nodes, of which there are as many
+ * as evaluations. Cubature rules integrate over boxes instead and count their own
+ * evaluations.
+ */
+struct Rule
+{
+	const char* name;
+	int sampled;
+	long intervals;		// between neighbouring nodes, for the fineness check
+	long evaluations;
+	void (*sums)(double left, double right, int nSegments, double* I, double* eps);
+	void (*nested)(double left, double right, const double* y, double* I, double* eps);
+	void (*precise)(double left, double right, int nSegments, double* I, double* eps);	// past BEST_FINENESS
+	long (*cube)(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis);
+};
+
+static const struct Rule rules[] = {
+	[RULE_TRAPEZOID]  = {"trapezoid", true, N_SUBSEGMENTS, N_SUBSEGMENTS + 2, sumsTrapezoid, NULL, sumsTrapezoidPrecise, NULL},
+	[RULE_GK15]       = {"gk15", false, 14, 15, sumsGaussKronrod, NULL, NULL, NULL},
+	[RULE_SIMPSON]    = {"simpson", false, 4, 5, NULL, nestedSimpson, NULL, NULL},
+	[RULE_ROMBERG]    = {"romberg", false, 1 << (ROMBERG_LEVELS - 1), (1 << (ROMBERG_LEVELS - 1)) + 1, NULL, nestedRomberg, NULL, NULL},
+	[RULE_GENZ_MALIK] = {"genz-malik", false, 2, 0, NULL, NULL, NULL, cubeGenzMalik},
+	[RULE_GAUSS]      = {"gauss", false, GAUSS_POINTS - 1, 0, NULL, NULL, NULL, cubeGauss}
+};
+
+static const struct Rule* rule = &rules[RULE_TRAPEZOID];
+
+/*
+ * Must run before the children are created so that they inherit the choice.
+ */
+void selectRule(enum QuadRule quadRule)
+{
+	rule = &rules[quadRule];
+}
+
+const char* ruleName()
+{
+	return rule->name;
+}
+
+/*
+ * Must run before the children are created. Replaces [*left, *right] with the
+ * interval of t that the parent integrates over instead.
+ */
+void selectTransform(enum Transform kind, double* left, double* right)
+{
+	transform = kind;
+	transformLeft = *left;
+	transformRight = *right;
+
+	if (kind == TRANSFORM_TANH_SINH)
+	{
+		*left = -TANH_SINH_LIMIT;
+		*right = TANH_SINH_LIMIT;
+	}
+	else if (kind == TRANSFORM_RATIONAL)
+	{
+		*left = isinf(transformLeft) ? -1 : 0;
+		*right = isinf(transformRight) ? 1 : 0;
+	}
+}
+
+int cubatureRule(enum QuadRule quadRule)
+{
+	return rules[quadRule].cube != NULL;
+}
+
+/*
+ * The residual of linear interpolation, and with it eps, shrinks with the square
+ * of the sample spacing. Picks the number of pieces for the halves of a segment
+ * that was sampled in nSegments pieces and refused with eps, so that they are
+ * likely to pass at dens.
+ */
+int chooseSegments(int nSegments, double eps, double dens)
+{
+	double wanted = SEGMENTS_SAFETY * nSegments / 2 * sqrt(eps / dens);
+
+	if (!(wanted < N_SEGMENTS))
+		return N_SEGMENTS;
+	if (wanted < MIN_SEGMENTS)
+		return MIN_SEGMENTS;
+
+	return (int)ceil(wanted);
+}
+
+void calcSums(double left, double right, int nSegments, double* I, double* eps, long* evaluations, enum ErrorCode* error)
+{
+	calcNodes(left, right, nSegments, NULL, 0, NULL, NULL, I, eps, evaluations, error);
+}
+
+/*
+ * known holds the values at the even nodes of the segment, as the parent took
+ * them from the nodes of the segment it was split from. Values that do not fit
+ * the rule are ignored.
+ */
+void calcNodes(double left, double right, int nSegments, const double* known, int nKnown, double* nodes, int* nNodes,
+double* I, double* eps, long* evaluations, enum ErrorCode* error)
+{
+	long pieces = rule->sampled ? nSegments : 1;
+
+	if (nNodes != NULL)
+		*nNodes = 0;
+
+	// A remote worker may have been started with a cubature rule or a library without 'func'.
+	if (rule->cube != NULL || !supportsDimension(1))
+	{
+		*evaluations = 0;
+		*error = ERR_OTHER;
+		return;
+	}
+
+	// Past BEST_FINENESS a rule with a precise variant goes on until its nodes are PRECISE_MIN_ULPS apart.
+	double spacing = (right - left) / pieces / rule->intervals;
+	int precise = spacing < BEST_FINENESS;
+	if (precise && (rule->precise == NULL
+		|| !(spacing >= PRECISE_MIN_ULPS * DBL_EPSILON * fmax(fmax(fabs(left), fabs(right)), 1.0))))
+	{
+		*error = ERR_BEST_FINENESS_REACHED;
+		return;
+	}
+
+	*evaluations = pieces * rule->evaluations;
+	*error = ERR_NO_ERROR;
+
+	if (precise)
+	{
+		rule->precise(left, right, nSegments, I, eps);
+		*evaluations = pieces * (rule->intervals + 1);
+	}
+	else if (rule->nested == NULL)
+		rule->sums(left, right, nSegments, I, eps);
+	else
+	{
+		double y[MAX_NODES];
+		int nodeCount = rule->evaluations;
+
+		if (known == NULL || nKnown != nodeCount / 2 + 1)
+			nKnown = 0;
+		else
+			memcpy(y, known, nKnown * sizeof(double));
+
+		evaluateNodes(left, right, nodeCount, nKnown, y);
+		rule->nested(left, right, y, I, eps);
+		*evaluations -= nKnown;
+
+		if (nodes != NULL)
+		{
+			memcpy(nodes, y, nodeCount * sizeof(double));
+			*nNodes = nodeCount;
+		}
+	}
+
+	// A node on a singularity; no narrower segment gets rid of it.
+	if (!isfinite(*I) || !isfinite(*eps))
+		*error = ERR_BEST_FINENESS_REACHED;
+}
+
+void calcBox(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis, long* evaluations, enum ErrorCode* error)
+{
+	*evaluations = 0;
+
+	if (rule->cube == NULL || !supportsDimension(dim))
+	{
+		*error = ERR_OTHER;
+		return;
+	}
+
+	int fine = (right - left) / rule->intervals < BEST_FINENESS;
+	for (int i = 0; i < dim - 1; i++)
+		fine = fine || (box->upper[i] - box->lower[i]) / rule->intervals < BEST_FINENESS;
+
+	if (fine)
+	{
+		*error = ERR_BEST_FINENESS_REACHED;
+		return;
+	}
+
+	*evaluations = rule->cube(left, right, box, dim, I, eps, axis);
+	*error = ERR_NO_ERROR;
+}
@@ -0,0 +1,91 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stddef.h>
+
+#include "general.h"
+
+#define BEST_FINENESS 1e-12
+
+/*
+ * Past BEST_FINENESS the trapezoid rule switches to double-double sums over the
+ * actual widths of its subsegments. It gives up when neighbouring nodes are
+ * less than PRECISE_MIN_ULPS ulps of x apart, or of 1 near 0.
+ */
+#define PRECISE_MIN_ULPS 16
+
+/*
+ * The integrand. Written as an expression so that the same text is compiled
+ * for doubles and for the vector types of the SIMD kernels.
+ */
+#define FUNCTION(x) (4 * (x) * (x) * (x))
+
+/*
+ * All kernels evaluate bitwise equal residuals; the SIMD ones only add them in a
+ * different order. S and eps of any two kernels agree within KERNEL_ULP_TOLERANCE.
+ */
+#define KERNEL_ULP_TOLERANCE 16
+
+/*
+ * The tanh-sinh transform integrates over t in [-TANH_SINH_LIMIT, TANH_SINH_LIMIT].
+ * Beyond it x'(t) is below 1e-270 of the width and x rounds to the ends.
+ */
+#define TANH_SINH_LIMIT 6
+
+// The last t of the rational transform before the infinite end at 1.
+#define RATIONAL_LIMIT (1 - 0x1p-52)
+
+// The Romberg rule extrapolates trapezoids with up to 2^(ROMBERG_LEVELS - 1) intervals, MAX_NODES - 1.
+#define ROMBERG_LEVELS 6
+
+/*
+ * Integrand loaded at run time. func is required, func_v is an optional
+ * vectorized entry point that evaluates n points in one call.
+ */
+typedef double (*Integrand)(double x);
+typedef void (*IntegrandV)(const double* x, double* y, size_t n);
+
+/*
+ * Integrand of a box of 2 to MAX_DIM dimensions. The built-in one is the
+ * product of FUNCTION() over the coordinates.
+ */
+typedef double (*IntegrandN)(const double* x, int dim);
+
+/*
+ * What identifies an integrand: its values at a few fixed points of 1, 2, 3 and
+ * MAX_DIM dimensions, NaN where it is not defined. Workers, checkpoints and
+ * partitions carry them, so that results of another integrand are not mixed in.
+ * Values of two hosts agree to INTEGRAND_TOLERANCE even if their libm differ.
+ */
+#define INTEGRAND_SAMPLES 8
+#define INTEGRAND_TOLERANCE 1e-12
+
+int loadFunction(const char* path);
+int supportsDimension(int dim);
+double evaluatePoint(const double* x, int dim);
+void sampleIntegrand(double* samples);
+int sameIntegrand(const double* samples, const double* other);
+
+void selectKernel(enum KernelImpl impl);
+const char* kernelName();
+
+void selectTransform(enum Transform kind, double* left, double* right);
+
+void selectRule(enum QuadRule rule);
+const char* ruleName();
+int cubatureRule(enum QuadRule rule);
+
+int chooseSegments(int nSegments, double eps, double dens);
+void calcSums(double left, double right, int nSegments, double* I, double* eps, long* evaluations, enum ErrorCode* error);
+
+/*
+ * calcSums() that reuses samples. For the nested rules, simpson and romberg, it
+ * takes the nKnown values at the even nodes from known and evaluates only the
+ * odd nodes; it stores the values at all *nNodes nodes in nodes. *nNodes is 0
+ * for the other rules, which evaluate everything.
+ */
+void calcNodes(double left, double right, int nSegments, const double* known, int nKnown, double* nodes, int* nNodes,
+double* I, double* eps, long* evaluations, enum ErrorCode* error);
+void calcBox(double left, double right, const struct Box* box, int dim, double* I, double* eps, int* axis, long* evaluations, enum ErrorCode* error);
+
+#endif
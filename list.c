@@ -1,30 +1,460 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
+#include <string.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "list.h"
+#include "cubature.h"
 
-struct SegmentList initList(double left, double right)
+/*
+ * Segments are carved from chunks of POOL_CHUNK_SEGMENTS nodes and recycled
+ * through a free list threaded over their next pointers. The chunks are
+ * released once the last segment of the last list is gone.
+ */
+struct PoolChunk
+{
+	struct PoolChunk* next;
+	struct UnstudiedSegment segs[POOL_CHUNK_SEGMENTS];
+};
+
+struct PoolChunk* poolChunks = NULL;
+struct UnstudiedSegment* poolFree = NULL;
+long poolUsed = 0;
+long poolPeak = 0;
+long poolChunksAllocated = 0;
+long poolPeakChunks = 0;
+
+// The values at the nodes of --reuse, pooled the same way.
+union NodeBlock
+{
+	struct NodeValues values;
+	union NodeBlock* next;
+};
+
+struct NodeChunk
+{
+	struct NodeChunk* next;
+	union NodeBlock blocks[POOL_CHUNK_NODES];
+};
+
+struct NodeChunk* nodeChunks = NULL;
+union NodeBlock* nodeFree = NULL;
+long nodesUsed = 0;
+long nodeChunksAllocated = 0;
+long nodePeakChunks = 0;
+
+static struct UnstudiedSegment* allocSegment()
+{
+	if (poolFree == NULL)
+	{
+		struct PoolChunk* chunk = malloc(sizeof(struct PoolChunk));
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->next = poolChunks;
+		poolChunks = chunk;
+
+		for (int i = POOL_CHUNK_SEGMENTS - 1; i >= 0; i--)
+		{
+			chunk->segs[i].next = poolFree;
+			poolFree = &chunk->segs[i];
+		}
+
+		if (++poolChunksAllocated > poolPeakChunks)
+			poolPeakChunks = poolChunksAllocated;
+	}
+
+	struct UnstudiedSegment* seg = poolFree;
+	poolFree = seg->next;
+
+	if (++poolUsed > poolPeak)
+		poolPeak = poolUsed;
+
+	return seg;
+}
+
+static void freeSegment(struct UnstudiedSegment* seg)
+{
+	seg->next = poolFree;
+	poolFree = seg;
+
+	if (--poolUsed > 0)
+		return;
+
+	while (poolChunks != NULL)
+	{
+		struct PoolChunk* chunk = poolChunks;
+		poolChunks = chunk->next;
+		free(chunk);
+	}
+	poolFree = NULL;
+	poolChunksAllocated = 0;
+}
+
+static struct NodeValues* allocNodes()
+{
+	if (nodeFree == NULL)
+	{
+		struct NodeChunk* chunk = malloc(sizeof(struct NodeChunk));
+		if (chunk == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for the values at the nodes.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		chunk->next = nodeChunks;
+		nodeChunks = chunk;
+
+		for (int i = POOL_CHUNK_NODES - 1; i >= 0; i--)
+		{
+			chunk->blocks[i].next = nodeFree;
+			nodeFree = &chunk->blocks[i];
+		}
+
+		if (++nodeChunksAllocated > nodePeakChunks)
+			nodePeakChunks = nodeChunksAllocated;
+	}
+
+	union NodeBlock* block = nodeFree;
+	nodeFree = block->next;
+	nodesUsed++;
+
+	block->values.nNodes = 0;
+	block->values.nKnown = 0;
+	return &block->values;
+}
+
+static void freeNodes(struct NodeValues* values)
+{
+	union NodeBlock* block = (union NodeBlock*)values;
+
+	if (values == NULL)
+		return;
+
+	block->next = nodeFree;
+	nodeFree = block;
+
+	if (--nodesUsed > 0)
+		return;
+
+	while (nodeChunks != NULL)
+	{
+		struct NodeChunk* chunk = nodeChunks;
+		nodeChunks = chunk->next;
+		free(chunk);
+	}
+	nodeFree = NULL;
+	nodeChunksAllocated = 0;
+}
+
+void getSegmentPoolStats(long* peakSegments, long* peakBytes)
+{
+	*peakSegments = poolPeak;
+	*peakBytes = poolPeakChunks * sizeof(struct PoolChunk) + nodePeakChunks * sizeof(struct NodeChunk);
+}
+
+/*
+ * Keeps the values at all nNodes nodes of an evaluated segment for its halves.
+ */
+void setSegNodes(struct UnstudiedSegment* seg, const double* values, int nNodes)
+{
+	if (nNodes == 0)
+	{
+		freeNodes(seg->nodes);
+		seg->nodes = NULL;
+		return;
+	}
+
+	if (seg->nodes == NULL)
+		seg->nodes = allocNodes();
+
+	seg->nodes->nNodes = nNodes;
+	seg->nodes->nKnown = 0;
+	memcpy(seg->nodes->values, values, nNodes * sizeof(double));
+}
+
+/*
+ * Whether a should be studied before b: bigger error first, wider first among equals.
+ * A NaN error, of an integrand undefined on the segment, counts as the biggest, so
+ * that it keeps the heap ordered.
+ */
+static int isWorse(struct UnstudiedSegment* a, struct UnstudiedSegment* b)
+{
+	if (!isnan(a->err) != !isnan(b->err))
+		return isnan(a->err) != 0;
+	if (!isnan(a->err) && a->err != b->err)
+		return a->err > b->err;
+
+	return (a->right - a->left) > (b->right - b->left);
+}
+
+static void heapPlace(struct SegmentStore* store, int i, struct UnstudiedSegment* seg)
+{
+	store->heap[i] = seg;
+	seg->heapIndex = i;
+}
+
+static void siftUp(struct SegmentStore* store, int i)
+{
+	struct UnstudiedSegment* seg = store->heap[i];
+
+	while (i > 0 && isWorse(seg, store->heap[(i - 1) / 2]))
+	{
+		heapPlace(store, i, store->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	heapPlace(store, i, seg);
+}
+
+static void siftDown(struct SegmentStore* store, int i)
+{
+	struct UnstudiedSegment* seg = store->heap[i];
+
+	while (true)
+	{
+		int worst = 2 * i + 1;
+		if (worst >= store->nFree)
+			break;
+
+		if (worst + 1 < store->nFree && isWorse(store->heap[worst + 1], store->heap[worst]))
+			worst++;
+
+		if (!isWorse(store->heap[worst], seg))
+			break;
+
+		heapPlace(store, i, store->heap[worst]);
+		i = worst;
+	}
+
+	heapPlace(store, i, seg);
+}
+
+static void heapPush(struct SegmentStore* store, struct UnstudiedSegment* seg)
+{
+	if (store->nFree == store->heapSize)
+	{
+		store->heapSize = store->heapSize ? store->heapSize * 2 : 0x100;
+		store->heap = realloc(store->heap, store->heapSize * sizeof(struct UnstudiedSegment*));
+		if (store->heap == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for the free segments heap.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	heapPlace(store, store->nFree++, seg);
+	siftUp(store, seg->heapIndex);
+}
+
+static void heapRemove(struct SegmentStore* store, struct UnstudiedSegment* seg)
+{
+	int i = seg->heapIndex;
+	struct UnstudiedSegment* last = store->heap[--store->nFree];
+
+	seg->heapIndex = -1;
+	if (last == seg)
+		return;
+
+	heapPlace(store, i, last);
+	siftUp(store, i);
+	siftDown(store, last->heapIndex);
+}
+
+/*
+ * Child tags +n and -n (RQ_FIRST and RQ_LAST of child n - 1) get slots 2n - 2 and 2n - 1.
+ */
+static struct SegmentSlot* slotFor(struct SegmentStore* store, int child)
+{
+	int slot = child > 0 ? 2 * child - 2 : -2 * child - 1;
+
+	if (slot >= store->nSlots)
+	{
+		int nSlots = store->nSlots ? store->nSlots : 0x10;
+		while (nSlots <= slot)
+			nSlots *= 2;
+
+		store->slots = realloc(store->slots, nSlots * sizeof(struct SegmentSlot));
+		if (store->slots == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for the segment slots.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = store->nSlots; i < nSlots; i++)
+			store->slots[i] = (struct SegmentSlot){NULL, NULL};
+		store->nSlots = nSlots;
+	}
+
+	return &store->slots[slot];
+}
+
+static void attach(struct UnstudiedSegment* seg)
 {
-	struct UnstudiedSegment* head = malloc(sizeof(struct UnstudiedSegment));
-	struct UnstudiedSegment* first = malloc(sizeof(struct UnstudiedSegment));
+	if (seg->child == 0)
+	{
+		heapPush(seg->store, seg);
+		return;
+	}
+
+	struct SegmentSlot* slot = slotFor(seg->store, seg->child);
+
+	seg->slotNext = NULL;
+	if (slot->tail != NULL)
+		slot->tail->slotNext = seg;
+	else
+		slot->head = seg;
+	slot->tail = seg;
+}
+
+static void detach(struct UnstudiedSegment* seg)
+{
+	if (seg->child == 0)
+	{
+		heapRemove(seg->store, seg);
+		return;
+	}
 
-	first->left = left;
-	first->right = right;
-	first->next = head;
-	first->prev = head;
-	first->child = 0;
+	struct SegmentSlot* slot = slotFor(seg->store, seg->child);
+	struct UnstudiedSegment* prev = NULL;
+	struct UnstudiedSegment* p = slot->head;
+
+	// Answers come back in order, so this is almost always the head.
+	while (p != NULL && p != seg)
+	{
+		prev = p;
+		p = p->slotNext;
+	}
+	if (p == NULL)
+		return;
+
+	if (prev != NULL)
+		prev->slotNext = seg->slotNext;
+	else
+		slot->head = seg->slotNext;
+
+	if (slot->tail == seg)
+		slot->tail = prev;
+}
+
+void setSegChild(struct UnstudiedSegment* seg, int child)
+{
+	detach(seg);
+	seg->child = child;
+	attach(seg);
+}
+
+/*
+ * Hands every segment in flight under tag from over to tag to, keeping their order.
+ */
+int moveSegs(struct SegmentList list, int from, int to)
+{
+	struct UnstudiedSegment* seg;
+	int n = 0;
 
-	head->next = first;
-	head->prev = first;
+	for (; (seg = getSeg(list, from)) != NULL; n++)
+		setSegChild(seg, to);
+
+	return n;
+}
+
+struct SegmentList initList(double left, double right)
+{
+	struct SegmentList list = emptyList();
 
-	struct SegmentList list = {.head = head};
 	list.startLen = right - left;
+	appendSeg(list, left, right, 0);
+
+	return list;
+}
+
+struct SegmentList emptyList()
+{
+	struct UnstudiedSegment* head = allocSegment();
+	struct SegmentStore* store = calloc(1, sizeof(struct SegmentStore));
+
+	if (head == NULL || store == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for segList.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	head->next = head;
+	head->prev = head;
+	head->store = store;
+
+	struct SegmentList list = {.head = head, .startLen = 0, .store = store};
 
 	return list;
 }
 
+/*
+ * Adds a free segment of the given job at the end of the list, ahead of all others in the heap.
+ */
+struct UnstudiedSegment* appendSeg(struct SegmentList list, double left, double right, int job)
+{
+	return restoreSeg(list, left, right, HUGE_VAL, N_SEGMENTS, job);
+}
+
+/*
+ * Appends a free segment that has been studied before, such as one from a checkpoint.
+ */
+struct UnstudiedSegment* restoreSeg(struct SegmentList list, double left, double right, double err, int nSegments, int job)
+{
+	struct UnstudiedSegment* seg = allocSegment();
+	if (seg == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for another segment in segList.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	seg->left = left;
+	seg->right = right;
+	seg->err = err;
+	seg->nSegments = nSegments;
+	seg->job = job;
+	unitBox(&seg->box);
+	seg->axis = 0;
+	seg->evaluated = false;
+	seg->nodes = NULL;
+	seg->store = list.store;
+	seg->child = 0;
+
+	seg->prev = list.head->prev;
+	seg->next = list.head;
+	list.head->prev->next = seg;
+	list.head->prev = seg;
+
+	attach(seg);
+	list.store->nSegments++;
+
+	return seg;
+}
+
+/*
+ * Removes the free segments of a job. Returns how many there were.
+ */
+int removeJobSegs(struct SegmentList list, int job)
+{
+	struct UnstudiedSegment* p = list.head->next;
+	int removed = 0;
+
+	while (p != list.head)
+	{
+		struct UnstudiedSegment* next = p->next;
+
+		if (p->job == job && p->child == 0)
+		{
+			removeSeg(p);
+			removed++;
+		}
+		p = next;
+	}
+
+	return removed;
+}
+
 void printList(struct SegmentList list)
 {
 	if (isEmpty(list))
@@ -59,7 +489,10 @@ void destroyList(struct SegmentList list)
 	while (!isEmpty(list))
 		removeSeg(list.head->next);
 
-	free(list.head);
+	free(list.store->heap);
+	free(list.store->slots);
+	free(list.store);
+	freeSegment(list.head);
 }
 
 struct UnstudiedSegment* findPlace(struct SegmentList list, double len)
@@ -104,23 +537,67 @@ void splitNParts(struct UnstudiedSegment* seg, int n)
 }
 */
 
+/*
+ * Halves the segment, a box along seg->axis. The halves of an evaluated segment
+ * have not been evaluated and go ahead of all others.
+ */
 void split(struct UnstudiedSegment* seg)
 {
 	if (seg == NULL)
 		return;
 
-	struct UnstudiedSegment* newSeg = malloc(sizeof(struct UnstudiedSegment));
-	if (errno != 0)
+	struct UnstudiedSegment* newSeg = allocSegment();
+	if (newSeg == NULL)
 	{
 		fprintf(stderr, "Failed to allocate memory for another segment in segList.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	double center = (seg->right + seg->left) / 2;
+	detach(seg);
 
-	newSeg->left = center;
+	newSeg->left = seg->left;
 	newSeg->right = seg->right;
-	seg->right = center;
+	newSeg->box = seg->box;
+
+	if (seg->axis == 0)
+	{
+		double center = (seg->right + seg->left) / 2;
+		newSeg->left = center;
+		seg->right = center;
+	}
+	else
+	{
+		int i = seg->axis - 1;
+		double center = (seg->box.upper[i] + seg->box.lower[i]) / 2;
+		newSeg->box.lower[i] = center;
+		seg->box.upper[i] = center;
+	}
+
+	seg->axis = 0;
+	newSeg->axis = 0;
+
+	// The left half keeps the first half of the nodes in place.
+	newSeg->nodes = NULL;
+	if (seg->nodes != NULL && seg->nodes->nNodes > 0)
+	{
+		int n = seg->nodes->nNodes;
+
+		newSeg->nodes = allocNodes();
+		memcpy(newSeg->nodes->values, seg->nodes->values + n / 2, (n / 2 + 1) * sizeof(double));
+		newSeg->nodes->nKnown = n / 2 + 1;
+		seg->nodes->nKnown = n / 2 + 1;
+		seg->nodes->nNodes = 0;
+	}
+	else
+		setSegNodes(seg, NULL, 0);
+
+	seg->err = seg->evaluated ? HUGE_VAL : seg->err / 2;
+	seg->evaluated = false;
+	newSeg->evaluated = false;
+	newSeg->err = seg->err;
+	newSeg->nSegments = seg->nSegments;
+	newSeg->job = seg->job;
+	newSeg->store = seg->store;
 
 	seg->child = 0;
 	newSeg->child = 0;
@@ -130,6 +607,10 @@ void split(struct UnstudiedSegment* seg)
 
 	newSeg->next = seg->next;
 	seg->next = newSeg;
+
+	attach(seg);
+	attach(newSeg);
+	seg->store->nSegments++;
 }
 
 /*
@@ -160,38 +641,69 @@ double removeSeg(struct UnstudiedSegment* seg)
 	
 	double DI = seg->S;
 
+	detach(seg);
+	seg->store->nSegments--;
+
 	seg->next->prev = seg->prev;
 	seg->prev->next = seg->next;
 
-	free(seg);
+	freeNodes(seg->nodes);
+	freeSegment(seg);
 
 	return DI;
 }
 
 int listLen(struct SegmentList segList)
 {
-	struct UnstudiedSegment* p = segList.head->next;
+	return segList.store->nSegments;
+}
 
-	int i = 0;
-	while (p != segList.head)
-	{
-		p = p->next;
-		i++;
-	}
-	return i;
+/*
+ * Width of a segment, or the volume of the box it stands for.
+ */
+double segVolume(struct UnstudiedSegment* seg)
+{
+	return boxVolume(seg->left, seg->right, &seg->box);
+}
+
+int freeLen(struct SegmentList segList)
+{
+	return segList.store->nFree;
 }
 
+/*
+ * For child == 0 returns the worst free segment, otherwise the oldest segment in flight under that tag.
+ */
 struct UnstudiedSegment* getSeg(struct SegmentList list, int child)
 {
-	if (isEmpty(list))
+	if (child == 0)
+		return list.store->nFree > 0 ? list.store->heap[0] : NULL;
+
+	return slotFor(list.store, child)->head;
+}
+
+static struct UnstudiedSegment* worstPassing
+(struct SegmentStore* store, int i, int (*pass)(struct UnstudiedSegment* seg, void* arg), void* arg)
+{
+	if (i >= store->nFree)
 		return NULL;
+	if (pass(store->heap[i], arg))
+		return store->heap[i];
 
-	for (struct UnstudiedSegment* p = list.head->next; p != list.head; p = p->next)
-	{
-		if (p->child == child)
-			return p;
-	}
-	return NULL;
+	struct UnstudiedSegment* a = worstPassing(store, 2 * i + 1, pass, arg);
+	struct UnstudiedSegment* b = worstPassing(store, 2 * i + 2, pass, arg);
+
+	return a == NULL || (b != NULL && isWorse(b, a)) ? b : a;
+}
+
+/*
+ * Returns the worst free segment for which pass() is true, or NULL. A segment
+ * of the heap is worse than every one below it, so only the subtrees under the
+ * segments that fail are searched.
+ */
+struct UnstudiedSegment* getFreeSegWhere(struct SegmentList list, int (*pass)(struct UnstudiedSegment* seg, void* arg), void* arg)
+{
+	return worstPassing(list.store, 0, pass, arg);
 }
 
 /*
@@ -3,34 +3,102 @@
 
 #include "general.h"
 
+#define POOL_CHUNK_SEGMENTS 0x400
+#define POOL_CHUNK_NODES 0x40	// only refused segments hold values at their nodes
+
+/*
+ * --reuse: values at all nNodes nodes of an evaluated segment, or at the nKnown
+ * even nodes that a half shares with the segment it was split from. They come
+ * from a pool of their own, so that runs without --reuse do not carry them.
+ */
+struct NodeValues
+{
+	int nNodes;
+	int nKnown;
+	double values[MAX_NODES];
+};
+
 struct UnstudiedSegment
 {
 	double left;
 	double right;
 	double S;
+	double err;
+	int nSegments;
+	int job;
+
+	// The other axes of a hyper-rectangle, and the one to split it along.
+	struct Box box;
+	int axis;
+
+	// Global adaptation: S and err are known and the segment waits to be split or accepted.
+	int evaluated;
+
+	// --reuse only, NULL until the segment has values at its nodes.
+	struct NodeValues* nodes;
 
 	struct UnstudiedSegment* next;
 	struct UnstudiedSegment* prev;
 
+	struct SegmentStore* store;
+	struct UnstudiedSegment* slotNext;
+	int heapIndex;
+
 	int child;
 };
 
+struct SegmentSlot
+{
+	struct UnstudiedSegment* head;
+	struct UnstudiedSegment* tail;
+};
+
+/*
+ * Indexes the segments of a list by state. Free segments (child == 0) sit in a
+ * max-heap on err, then width, so the worst segment goes out first. Segments in
+ * flight are queued in one slot per child tag in the order they were sent, so
+ * getSeg() is O(1) for any tag.
+ */
+struct SegmentStore
+{
+	struct UnstudiedSegment** heap;
+	int nFree;
+	int heapSize;
+
+	struct SegmentSlot* slots;
+	int nSlots;
+
+	int nSegments;
+};
+
 struct SegmentList
 {
 	struct UnstudiedSegment* head;
 	double startLen;
+	struct SegmentStore* store;
 };
 
 void split(struct UnstudiedSegment* seg);
+void setSegNodes(struct UnstudiedSegment* seg, const double* values, int nNodes);
+void setSegChild(struct UnstudiedSegment* seg, int child);
+int moveSegs(struct SegmentList list, int from, int to);
 //void redoubleViligance(struct UnstudiedSegment* seg);
 //void splitNParts(struct UnstudiedSegment* seg, int n);
 double removeSeg(struct UnstudiedSegment* seg);
 struct UnstudiedSegment* getSeg(struct SegmentList segList, int child);
+struct UnstudiedSegment* getFreeSegWhere(struct SegmentList segList, int (*pass)(struct UnstudiedSegment* seg, void* arg), void* arg);
 struct SegmentList initList(double left, double right);
+struct SegmentList emptyList();
+struct UnstudiedSegment* appendSeg(struct SegmentList list, double left, double right, int job);
+struct UnstudiedSegment* restoreSeg(struct SegmentList list, double left, double right, double err, int nSegments, int job);
+int removeJobSegs(struct SegmentList list, int job);
 void printList(struct SegmentList list);
 int listLen(struct SegmentList list);
+double segVolume(struct UnstudiedSegment* seg);
+int freeLen(struct SegmentList list);
 int isEmpty(struct SegmentList list);
 void destroyList(struct SegmentList list);
+void getSegmentPoolStats(long* peakSegments, long* peakBytes);
 //struct UnstudiedSegment* getWidestFree(struct SegmentList list);
 
 #endif
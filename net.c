@@ -0,0 +1,639 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "net.h"
+#include "ui.h"
+#include "kernel.h"
+
+/*
+ * TCP transport of the remote workers. A connection is one child: the
+ * coordinator opens as many as it wants workers and a worker serves each in a
+ * thread of its own.
+ */
+
+#define NET_HEADER_SIZE 12
+#define NET_HELLO_SIZE (8 + 8 * INTEGRAND_SAMPLES)
+// Each request and answer is followed by its nKnown or nNodes values, see CalcBatch.
+#define NET_REQUEST_SIZE (48 + 16 * (MAX_DIM - 1))
+#define NET_ANSWER_SIZE 60
+#define NET_REQUEST_MAX (NET_REQUEST_SIZE + 8 * MAX_KNOWN)
+#define NET_ANSWER_MAX (NET_ANSWER_SIZE + 8 * MAX_NODES)
+#define NET_PAYLOAD_MAX (4 + MAX_BATCH * (NET_REQUEST_MAX > NET_ANSWER_MAX ? NET_REQUEST_MAX : NET_ANSWER_MAX))
+
+static unsigned char* put32(unsigned char* p, uint32_t value)
+{
+	value = htobe32(value);
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+static unsigned char* put64(unsigned char* p, uint64_t value)
+{
+	value = htobe64(value);
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+static unsigned char* putDouble(unsigned char* p, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return put64(p, bits);
+}
+
+static const unsigned char* get32(const unsigned char* p, uint32_t* value)
+{
+	memcpy(value, p, sizeof(*value));
+	*value = be32toh(*value);
+	return p + sizeof(*value);
+}
+
+static const unsigned char* get64(const unsigned char* p, uint64_t* value)
+{
+	memcpy(value, p, sizeof(*value));
+	*value = be64toh(*value);
+	return p + sizeof(*value);
+}
+
+static const unsigned char* getDouble(const unsigned char* p, double* value)
+{
+	uint64_t bits;
+	p = get64(p, &bits);
+	memcpy(value, &bits, sizeof(bits));
+	return p;
+}
+
+static int sendAll(int fd, const void* buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t sent;
+
+	while (done < size)
+	{
+		sent = send(fd, (const char*)buf + done, size - done, MSG_NOSIGNAL);
+		if (sent <= 0)
+			return false;
+		done += sent;
+	}
+
+	return true;
+}
+
+static int recvAll(int fd, void* buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t received;
+
+	while (done < size)
+	{
+		received = recv(fd, (char*)buf + done, size - done, 0);
+		if (received <= 0)
+			return false;
+		done += received;
+	}
+
+	return true;
+}
+
+static int sendMessage(struct NetPeer* peer, enum NetMessage type, const unsigned char* payload, uint32_t length)
+{
+	unsigned char buf[NET_HEADER_SIZE + NET_PAYLOAD_MAX];
+	unsigned char* p = buf;
+
+	p = put32(p, NET_MAGIC);
+	p = put32(p, (uint32_t)NET_VERSION << 16 | type);
+	p = put32(p, length);
+	if (length > 0)
+		memcpy(p, payload, length);
+
+	pthread_mutex_lock(&peer->writeLock);
+	int sent = sendAll(peer->fd, buf, NET_HEADER_SIZE + length);
+	peer->lastSent = nowMicros();
+	pthread_mutex_unlock(&peer->writeLock);
+
+	return sent;
+}
+
+/*
+ * Reads the next message, waiting at most timeoutMs for it to begin. Returns
+ * false on silence, a broken connection or a message of another protocol.
+ */
+static int readMessage(struct NetPeer* peer, enum NetMessage* type, unsigned char* payload, uint32_t* length, int timeoutMs)
+{
+	unsigned char header[NET_HEADER_SIZE];
+	struct pollfd pfd = {peer->fd, POLLIN, 0};
+	uint32_t magic, versionType;
+
+	if (poll(&pfd, 1, timeoutMs) <= 0 || !recvAll(peer->fd, header, sizeof(header)))
+		return false;
+
+	const unsigned char* p = header;
+	p = get32(p, &magic);
+	p = get32(p, &versionType);
+	get32(p, length);
+
+	if (magic != NET_MAGIC)
+	{
+		fprintf(stderr, "%s does not speak the integrate protocol.\n", peer->address);
+		return false;
+	}
+	if (versionType >> 16 != NET_VERSION)
+	{
+		fprintf(stderr, "%s speaks protocol version %u, this is version %d.\n", peer->address, versionType >> 16, NET_VERSION);
+		return false;
+	}
+	if (*length > NET_PAYLOAD_MAX || !recvAll(peer->fd, payload, *length))
+		return false;
+
+	*type = versionType & 0xffff;
+	peer->lastHeard = nowMicros();
+	return true;
+}
+
+/*
+ * Sends a heartbeat if nothing has been sent for NET_HEARTBEAT_MS.
+ */
+static int sendHeartbeat(struct NetPeer* peer)
+{
+	pthread_mutex_lock(&peer->writeLock);
+	int quiet = nowMicros() - peer->lastSent >= NET_HEARTBEAT_MS * 1000L;
+	pthread_mutex_unlock(&peer->writeLock);
+
+	return !quiet || sendMessage(peer, NET_HEARTBEAT, NULL, 0);
+}
+
+/*
+ * Splits "HOST:PORT", "[HOST]:PORT" or "PORT"; host is empty in the last case.
+ */
+static int splitEndpoint(const char* endpoint, char* host, char* port)
+{
+	const char* colon = strrchr(endpoint, ':');
+	const char* hostStart = endpoint;
+	size_t hostLen = colon == NULL ? 0 : colon - endpoint;
+
+	if (strlen(endpoint) >= NET_ADDRESS_MAX)
+		return false;
+
+	strcpy(port, colon == NULL ? endpoint : colon + 1);
+	if (hostLen >= 2 && hostStart[0] == '[' && hostStart[hostLen - 1] == ']')
+	{
+		hostStart++;
+		hostLen -= 2;
+	}
+
+	memcpy(host, hostStart, hostLen);
+	host[hostLen] = '\0';
+	return *port != '\0';
+}
+
+static struct NetPeer* newPeer(int fd, const char* address)
+{
+	struct NetPeer* peer = calloc(1, sizeof(struct NetPeer));
+	int one = 1;
+
+	if (peer == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	peer->fd = fd;
+	snprintf(peer->address, sizeof(peer->address), "%s", address);
+	pthread_mutex_init(&peer->writeLock, NULL);
+	peer->lastSent = nowMicros();
+	peer->lastHeard = peer->lastSent;
+
+	return peer;
+}
+
+static void freePeer(struct NetPeer* peer)
+{
+	close(peer->fd);
+	pthread_mutex_destroy(&peer->writeLock);
+	free(peer);
+}
+
+int netCountEndpoints(const char* list)
+{
+	int n = 1;
+
+	for (; *list != '\0'; list++)
+		if (*list == ',')
+			n++;
+
+	return n;
+}
+
+/*
+ * Copies the index-th entry of a comma separated list.
+ */
+int netEndpoint(const char* list, int index, char* endpoint, int size)
+{
+	for (; index > 0 && list != NULL; index--)
+		if ((list = strchr(list, ',')) != NULL)
+			list++;
+
+	if (list == NULL)
+		return false;
+
+	int len = strcspn(list, ",");
+	if (len == 0 || len >= size)
+		return false;
+
+	memcpy(endpoint, list, len);
+	endpoint[len] = '\0';
+	return true;
+}
+
+static unsigned char* putHello(unsigned char* p, enum QuadRule rule, enum Summation summation, const double* samples)
+{
+	p = put32(p, rule);
+	p = put32(p, summation);
+	for (int i = 0; i < INTEGRAND_SAMPLES; i++)
+		p = putDouble(p, samples[i]);
+	return p;
+}
+
+static void getHello(const unsigned char* p, uint32_t* rule, uint32_t* summation, double* samples)
+{
+	p = get32(p, rule);
+	p = get32(p, summation);
+	for (int i = 0; i < INTEGRAND_SAMPLES; i++)
+		p = getDouble(p, &samples[i]);
+}
+
+/*
+ * Connects to a worker and agrees on the protocol, the rule, the summation and the integrand.
+ * errno is left as it was, the callers check it after every send.
+ */
+struct NetPeer* netConnect(const char* endpoint, enum QuadRule rule, enum Summation summation, const double* samples)
+{
+	char host[NET_ADDRESS_MAX], port[NET_ADDRESS_MAX];
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	struct addrinfo* addrs;
+	int savedErrno = errno;
+	int fd = -1;
+
+	if (!splitEndpoint(endpoint, host, port) || *host == '\0'
+		|| getaddrinfo(host, port, &hints, &addrs) != 0)
+	{
+		fprintf(stderr, "Cannot resolve worker %s; use HOST:PORT.\n", endpoint);
+		return NULL;
+	}
+
+	for (struct addrinfo* a = addrs; a != NULL && fd < 0; a = a->ai_next)
+	{
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "Cannot connect to worker %s: %s\n", endpoint, strerror(errno));
+		return NULL;
+	}
+
+	struct NetPeer* peer = newPeer(fd, endpoint);
+	unsigned char payload[NET_PAYLOAD_MAX];
+	enum NetMessage type;
+	uint32_t length, agreed, agreedSummation;
+	double agreedSamples[INTEGRAND_SAMPLES];
+
+	putHello(payload, rule, summation, samples);
+	if (!sendMessage(peer, NET_HELLO, payload, NET_HELLO_SIZE)
+		|| !readMessage(peer, &type, payload, &length, NET_DEAD_MS)
+		|| type != NET_HELLO || length != NET_HELLO_SIZE
+		|| (getHello(payload, &agreed, &agreedSummation, agreedSamples), agreed != (uint32_t)rule)
+		|| agreedSummation != (uint32_t)summation || !sameIntegrand(samples, agreedSamples))
+	{
+		fprintf(stderr, "Worker %s refused the connection.\n", endpoint);
+		freePeer(peer);
+		return NULL;
+	}
+
+	errno = savedErrno;
+	return peer;
+}
+
+/*
+ * Listens on "[HOST:]PORT"; without a host on every interface.
+ */
+int netListen(const char* address)
+{
+	char host[NET_ADDRESS_MAX], port[NET_ADDRESS_MAX];
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+	struct addrinfo* addrs;
+	int fd = -1, one = 1;
+
+	if (!splitEndpoint(address, host, port)
+		|| getaddrinfo(*host == '\0' ? NULL : host, port, &hints, &addrs) != 0)
+		return -1;
+
+	for (struct addrinfo* a = addrs; a != NULL && fd < 0; a = a->ai_next)
+	{
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, NET_BACKLOG) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+
+	return fd;
+}
+
+/*
+ * Accepts a coordinator. It must integrate the same integrand with the rule
+ * and the summation this worker was started with.
+ */
+struct NetPeer* netAccept(int listenFd, enum QuadRule rule, enum Summation summation, const double* samples)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrLen = sizeof(addr);
+	char host[64], port[16], address[NET_ADDRESS_MAX];
+
+	int fd = accept(listenFd, (struct sockaddr*)&addr, &addrLen);
+	if (fd < 0)
+		return NULL;
+
+	if (getnameinfo((struct sockaddr*)&addr, addrLen, host, sizeof(host), port, sizeof(port),
+		NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+		strcpy(host, "?"), strcpy(port, "?");
+	snprintf(address, sizeof(address), "%s:%s", host, port);
+
+	struct NetPeer* peer = newPeer(fd, address);
+	unsigned char payload[NET_PAYLOAD_MAX];
+	enum NetMessage type;
+	uint32_t length, asked, askedSummation;
+	double askedSamples[INTEGRAND_SAMPLES];
+
+	if (!readMessage(peer, &type, payload, &length, NET_DEAD_MS) || type != NET_HELLO || length != NET_HELLO_SIZE)
+	{
+		freePeer(peer);
+		return NULL;
+	}
+
+	getHello(payload, &asked, &askedSummation, askedSamples);
+	if (asked != (uint32_t)rule || askedSummation != (uint32_t)summation || !sameIntegrand(samples, askedSamples))
+	{
+		fprintf(stderr, "Coordinator %s uses another %s; start the worker with the same --rule, --sum and --function.\n",
+			address, asked != (uint32_t)rule ? "quadrature rule" : askedSummation != (uint32_t)summation ? "summation" : "integrand");
+		sendMessage(peer, NET_BYE, NULL, 0);
+		freePeer(peer);
+		return NULL;
+	}
+
+	if (!sendMessage(peer, NET_HELLO, payload, NET_HELLO_SIZE))
+	{
+		freePeer(peer);
+		return NULL;
+	}
+
+	return peer;
+}
+
+static void* heartbeatThread(void* arg)
+{
+	struct NetPeer* peer = arg;
+	struct timespec tick = {0, NET_HEARTBEAT_MS * 1000000L / 4};
+
+	while (!__atomic_load_n(&peer->closed, __ATOMIC_ACQUIRE))
+	{
+		nanosleep(&tick, NULL);
+		sendHeartbeat(peer);
+	}
+
+	return NULL;
+}
+
+/*
+ * A worker keeps sending heartbeats from a thread of its own, so that a long
+ * batch does not look like a dead worker.
+ */
+void netStartHeartbeat(struct NetPeer* peer)
+{
+	peer->hasHeartbeat = pthread_create(&peer->heartbeat, NULL, heartbeatThread, peer) == 0;
+}
+
+void netClose(struct NetPeer* peer)
+{
+	__atomic_store_n(&peer->closed, true, __ATOMIC_RELEASE);
+	if (peer->hasHeartbeat)
+		pthread_join(peer->heartbeat, NULL);
+
+	sendMessage(peer, NET_BYE, NULL, 0);
+	freePeer(peer);
+}
+
+int netSendRequests(struct NetPeer* peer, struct CalcBatch* batch)
+{
+	unsigned char payload[NET_PAYLOAD_MAX];
+	unsigned char* p = put32(payload, batch->n);
+	struct CalcRequest* rq = batch->rq;
+
+	for (int i = 0; i < batch->n; i++)
+	{
+		p = putDouble(p, rq[i].left);
+		p = putDouble(p, rq[i].right);
+		p = putDouble(p, rq[i].dens);
+		p = put32(p, rq[i].nSegments);
+		p = put64(p, rq[i].sent);
+		p = put32(p, rq[i].dim);
+		for (int k = 0; k < MAX_DIM - 1; k++)
+		{
+			p = putDouble(p, rq[i].box.lower[k]);
+			p = putDouble(p, rq[i].box.upper[k]);
+		}
+		p = put32(p, rq[i].reuse);
+		p = put32(p, rq[i].nKnown);
+		for (int k = 0; k < rq[i].nKnown; k++)
+			p = putDouble(p, batch->known[i][k]);
+	}
+
+	return sendMessage(peer, NET_REQUESTS, payload, p - payload);
+}
+
+/*
+ * Waits for the next batch. Heartbeats are skipped; a coordinator silent
+ * for NET_DEAD_MS is taken for dead.
+ */
+int netReadRequests(struct NetPeer* peer, struct CalcBatch* batch)
+{
+	unsigned char payload[NET_PAYLOAD_MAX];
+	enum NetMessage type;
+	uint32_t length, n, nSegments, dim, reuse, nKnown;
+	uint64_t sent;
+
+	do
+		if (!readMessage(peer, &type, payload, &length, NET_DEAD_MS))
+			return false;
+	while (type == NET_HEARTBEAT);
+
+	const unsigned char* p = get32(payload, &n);
+	const unsigned char* end = payload + length;
+	if (type != NET_REQUESTS || n == 0 || n > MAX_BATCH || length < 4)
+		return false;
+
+	batch->n = n;
+	for (int i = 0; i < batch->n; i++)
+	{
+		struct CalcRequest* rq = &batch->rq[i];
+
+		if (end - p < NET_REQUEST_SIZE)
+			return false;
+
+		p = getDouble(p, &rq->left);
+		p = getDouble(p, &rq->right);
+		p = getDouble(p, &rq->dens);
+		p = get32(p, &nSegments);
+		p = get64(p, &sent);
+		p = get32(p, &dim);
+		for (int k = 0; k < MAX_DIM - 1; k++)
+		{
+			p = getDouble(p, &rq->box.lower[k]);
+			p = getDouble(p, &rq->box.upper[k]);
+		}
+		p = get32(p, &reuse);
+		p = get32(p, &nKnown);
+		if (nKnown > MAX_KNOWN || end - p < 8 * (long)nKnown)
+			return false;
+		for (uint32_t k = 0; k < nKnown; k++)
+			p = getDouble(p, &batch->known[i][k]);
+
+		rq->nSegments = (int32_t)nSegments;
+		rq->sent = (int64_t)sent;
+		rq->dim = dim;
+		rq->reuse = reuse != 0;
+		rq->nKnown = nKnown;
+	}
+
+	return p == end;
+}
+
+/*
+ * The clocks of two hosts are not comparable, so an answer carries only how long
+ * the request waited in the worker and how long it took to compute.
+ */
+int netSendAnswers(struct NetPeer* peer, struct AnswerBatch* answers)
+{
+	unsigned char payload[NET_PAYLOAD_MAX];
+	unsigned char* p = put32(payload, answers->n);
+	struct ChildAnswer* ans = answers->ans;
+
+	for (int i = 0; i < answers->n; i++)
+	{
+		p = putDouble(p, ans[i].S);
+		p = putDouble(p, ans[i].eps);
+		p = put64(p, ans[i].evaluations);
+		p = put32(p, ans[i].error);
+		p = put32(p, ans[i].axis);
+		p = put64(p, ans[i].sent);
+		p = put64(p, ans[i].started - ans[i].received);
+		p = put64(p, ans[i].sentBack - ans[i].started);
+		p = put32(p, ans[i].nNodes);
+		for (int k = 0; k < ans[i].nNodes; k++)
+			p = putDouble(p, answers->nodes[i][k]);
+	}
+
+	return sendMessage(peer, NET_ANSWERS, payload, p - payload);
+}
+
+/*
+ * Reads one message of a worker that select() found readable. A heartbeat gives
+ * no answers. The worker's times are put on this host's clock as if the answers
+ * were sent back just now.
+ */
+int netReadAnswers(struct NetPeer* peer, struct AnswerBatch* answers)
+{
+	unsigned char payload[NET_PAYLOAD_MAX];
+	enum NetMessage type;
+	uint32_t length, n, error, axis, nNodes;
+	uint64_t evaluations, sent, waited, computed;
+
+	if (!readMessage(peer, &type, payload, &length, NET_DEAD_MS))
+		return false;
+
+	answers->n = 0;
+	if (type == NET_HEARTBEAT)
+		return true;
+
+	const unsigned char* p = get32(payload, &n);
+	const unsigned char* end = payload + length;
+	if (type != NET_ANSWERS || n == 0 || n > MAX_BATCH || length < 4)
+		return false;
+
+	long arrived = nowMicros();
+
+	answers->n = n;
+	for (int i = 0; i < answers->n; i++)
+	{
+		struct ChildAnswer* ans = &answers->ans[i];
+
+		if (end - p < NET_ANSWER_SIZE)
+			return false;
+
+		p = getDouble(p, &ans->S);
+		p = getDouble(p, &ans->eps);
+		p = get64(p, &evaluations);
+		p = get32(p, &error);
+		p = get32(p, &axis);
+		p = get64(p, &sent);
+		p = get64(p, &waited);
+		p = get64(p, &computed);
+		p = get32(p, &nNodes);
+		if (nNodes > MAX_NODES || end - p < 8 * (long)nNodes)
+			return false;
+		for (uint32_t k = 0; k < nNodes; k++)
+			p = getDouble(p, &answers->nodes[i][k]);
+
+		ans->evaluations = (int64_t)evaluations;
+		ans->error = error;
+		ans->axis = axis < MAX_DIM ? (int)axis : 0;
+		ans->nNodes = nNodes;
+		ans->sent = (int64_t)sent;
+		ans->sentBack = arrived;
+		ans->started = arrived - (int64_t)computed;
+		ans->received = ans->started - (int64_t)waited;
+	}
+
+	return p == end;
+}
+
+/*
+ * Coordinator side of the heartbeats. Returns false once the worker has been silent too long.
+ */
+int netKeepAlive(struct NetPeer* peer)
+{
+	if (nowMicros() - peer->lastHeard > NET_DEAD_MS * 1000L)
+	{
+		fprintf(stderr, "Worker %s has been silent for %d ms.\n", peer->address, NET_DEAD_MS);
+		return false;
+	}
+
+	return sendHeartbeat(peer);
+}
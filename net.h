@@ -0,0 +1,62 @@
+#ifndef NET_H
+#define NET_H
+
+#include <pthread.h>
+
+#include "general.h"
+
+/*
+ * Wire format between a coordinator and its remote workers. Every message is a
+ * 12 byte header, magic, version, type and payload length, followed by the
+ * payload. All fields are big-endian; doubles travel as the bits of an IEEE 754
+ * binary64. A peer with another version is dropped at the handshake.
+ */
+#define NET_MAGIC 0x494e5447	// "INTG"
+#define NET_VERSION 6
+
+// Either side sends a heartbeat after this long without a message and gives up on a peer silent for NET_DEAD_MS.
+#define NET_HEARTBEAT_MS 1000
+#define NET_DEAD_MS 5000
+
+#define NET_BACKLOG 0x10
+#define NET_ADDRESS_MAX 0x100
+
+enum NetMessage {
+	NET_HELLO = 1,		// rule, summation and sampleIntegrand(); the coordinator sends it first and the worker echoes it back
+	NET_REQUESTS,		// n, then n requests, each followed by its nKnown values
+	NET_ANSWERS,		// n, then n answers, each followed by its nNodes values
+	NET_HEARTBEAT,		// empty
+	NET_BYE				// empty; the sender closes the connection
+};
+
+struct NetPeer
+{
+	int fd;
+	char address[NET_ADDRESS_MAX];
+
+	// Answers and heartbeats of a worker come from two threads.
+	pthread_mutex_t writeLock;
+	long lastSent;
+	long lastHeard;
+
+	int closed;
+	int hasHeartbeat;
+	pthread_t heartbeat;
+};
+
+int netCountEndpoints(const char* list);
+int netEndpoint(const char* list, int index, char* endpoint, int size);
+
+struct NetPeer* netConnect(const char* endpoint, enum QuadRule rule, enum Summation summation, const double* samples);
+int netListen(const char* address);
+struct NetPeer* netAccept(int listenFd, enum QuadRule rule, enum Summation summation, const double* samples);
+void netStartHeartbeat(struct NetPeer* peer);
+void netClose(struct NetPeer* peer);
+
+int netSendRequests(struct NetPeer* peer, struct CalcBatch* batch);
+int netReadRequests(struct NetPeer* peer, struct CalcBatch* batch);
+int netSendAnswers(struct NetPeer* peer, struct AnswerBatch* answers);
+int netReadAnswers(struct NetPeer* peer, struct AnswerBatch* answers);
+int netKeepAlive(struct NetPeer* peer);
+
+#endif
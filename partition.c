@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "partition.h"
+#include "kernel.h"
+
+#define PARTITION_MAGIC "INTGPART"
+#define PARTITION_BYTE_ORDER 0x01020304
+
+/*
+ * File layout: the header, then nSegments segments in the order they were
+ * accepted. Both are written as they are in memory, like checkpoints.
+ */
+struct PartitionHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	char rule[PARTITION_RULE_MAX];
+	double samples[INTEGRAND_SAMPLES];	// sampleIntegrand()
+
+	double left;
+	double right;
+	int64_t nSegments;
+} __attribute__((packed));
+
+struct PartitionSegment
+{
+	double left;
+	double right;
+	double S;
+	double eps;
+	int32_t nSegments;
+} __attribute__((packed));
+
+static char* partitionPath = NULL;
+static double partitionLeft, partitionRight;
+static double samples[INTEGRAND_SAMPLES];
+
+// What was read from the file, until partitionRestore() puts it into the list.
+static struct PartitionSegment* loaded = NULL;
+static long nLoaded = 0;
+
+// The partition of this run.
+static struct PartitionSegment* accepted = NULL;
+static long nAccepted = 0;
+static long acceptedSize = 0;
+
+static int readFile(double left, double right)
+{
+	struct PartitionHeader header;
+	FILE* in = fopen(partitionPath, "rb");
+
+	// No partition yet: the first run makes one.
+	if (in == NULL)
+	{
+		errno = 0;
+		return true;
+	}
+
+	int ok = fread(&header, sizeof(header), 1, in) == 1
+		&& memcmp(header.magic, PARTITION_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == PARTITION_VERSION
+		&& header.byteOrder == PARTITION_BYTE_ORDER
+		&& header.nSegments >= 0;
+
+	if (ok)
+	{
+		loaded = malloc((header.nSegments + 1) * sizeof(struct PartitionSegment));
+		if (loaded == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for a partition.\n");
+			exit(EXIT_FAILURE);
+		}
+		ok = fread(loaded, sizeof(struct PartitionSegment), header.nSegments, in) == (size_t)header.nSegments;
+	}
+	fclose(in);
+
+	if (!ok)
+	{
+		fprintf(stderr, "%s is not a partition of this version of integrate.\n", partitionPath);
+		return false;
+	}
+
+	if (header.left != left || header.right != right || strncmp(header.rule, ruleName(), PARTITION_RULE_MAX) != 0)
+	{
+		fprintf(stderr, "%s is a partition of %.17g %.17g with rule %.*s; reuse it with the same arguments.\n",
+			partitionPath, header.left, header.right, PARTITION_RULE_MAX, header.rule);
+		return false;
+	}
+
+	double saved[INTEGRAND_SAMPLES];
+	memcpy(saved, header.samples, sizeof(saved));
+	if (!sameIntegrand(saved, samples))
+	{
+		fprintf(stderr, "%s is a partition of another integrand; reuse it with the same --function.\n", partitionPath);
+		return false;
+	}
+
+	nLoaded = header.nSegments;
+	return true;
+}
+
+static int writeFile()
+{
+	char* tmpPath = malloc(strlen(partitionPath) + sizeof(".tmp"));
+	if (tmpPath == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmpPath, "%s.tmp", partitionPath);
+
+	struct PartitionHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PARTITION_MAGIC, sizeof(header.magic));
+	header.version = PARTITION_VERSION;
+	header.byteOrder = PARTITION_BYTE_ORDER;
+	strncpy(header.rule, ruleName(), PARTITION_RULE_MAX);
+	memcpy(header.samples, samples, sizeof(header.samples));
+	header.left = partitionLeft;
+	header.right = partitionRight;
+	header.nSegments = nAccepted;
+
+	int ok = false;
+	FILE* out = fopen(tmpPath, "wb");
+	if (out != NULL)
+	{
+		ok = fwrite(&header, sizeof(header), 1, out) == 1
+			&& fwrite(accepted, sizeof(struct PartitionSegment), nAccepted, out) == (size_t)nAccepted
+			&& fflush(out) == 0
+			&& fsync(fileno(out)) == 0;
+		ok = fclose(out) == 0 && ok;
+	}
+
+	if (!ok || rename(tmpPath, partitionPath) != 0)
+	{
+		fprintf(stderr, "Failed to write partition %s.\n", partitionPath);
+		unlink(tmpPath);
+		ok = false;
+	}
+
+	free(tmpPath);
+	return ok;
+}
+
+int partitionOpen(const char* path, double left, double right)
+{
+	partitionPath = strdup(path);
+	if (partitionPath == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	partitionLeft = left;
+	partitionRight = right;
+	sampleIntegrand(samples);
+
+	if (!readFile(left, right))
+	{
+		free(partitionPath);
+		free(loaded);
+		partitionPath = NULL;
+		loaded = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Replaces the root segment that startJobs() gave the job with the loaded
+ * partition. A segment that passes at the job's density is accepted as it is;
+ * one that does not is split at once, since its eps is known.
+ */
+void partitionRestore(struct SegmentList segList, struct Job* job, struct StatsSample* progress)
+{
+	if (loaded == NULL)
+		return;
+
+	long reused = 0;
+
+	removeJobSegs(segList, 0);
+	job->pending = 0;
+
+	for (long i = 0; i < nLoaded; i++)
+	{
+		struct PartitionSegment* saved = &loaded[i];
+		double width = saved->right - saved->left;
+
+		if (saved->eps < job->dens)
+		{
+			progress->resolvedWidth += width;
+			progress->errorSpent += saved->eps * width;
+			progress->completed++;
+			progress->I += saved->S;
+
+			acceptSegment(job, saved->left, &job->box, saved->S);
+			job->errorSpent += saved->eps * width;
+			partitionAccept(saved->left, saved->right, saved->S, saved->eps, saved->nSegments);
+			reused++;
+			continue;
+		}
+
+		struct UnstudiedSegment* seg = restoreSeg(segList, saved->left, saved->right,
+			saved->eps * width / job->maxDeviation, chooseSegments(saved->nSegments, saved->eps, job->dens), 0);
+		split(seg);
+		job->pending += 2;
+	}
+
+	fprintf(stderr, "Reused %ld of %ld segments of %s.\n", reused, nLoaded, partitionPath);
+
+	free(loaded);
+	loaded = NULL;
+	nLoaded = 0;
+}
+
+void partitionAccept(double left, double right, double S, double eps, int nSegments)
+{
+	if (partitionPath == NULL)
+		return;
+
+	if (nAccepted == acceptedSize)
+	{
+		acceptedSize = acceptedSize > 0 ? 2 * acceptedSize : 0x100;
+		accepted = realloc(accepted, acceptedSize * sizeof(struct PartitionSegment));
+		if (accepted == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for a partition.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	accepted[nAccepted++] = (struct PartitionSegment){left, right, S, eps, nSegments};
+}
+
+/*
+ * Writes the partition of a complete run. An incomplete one leaves the file as it was.
+ */
+void partitionClose(int complete)
+{
+	if (partitionPath == NULL)
+		return;
+
+	if (complete && nAccepted > 0)
+		writeFile();
+
+	free(partitionPath);
+	free(loaded);
+	free(accepted);
+	partitionPath = NULL;
+	loaded = NULL;
+	accepted = NULL;
+	nLoaded = nAccepted = acceptedSize = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "general.h"
+#include "list.h"
+#include "jobs.h"
+#include "stats.h"
+
+#define PARTITION_VERSION 2
+#define PARTITION_RULE_MAX 16
+
+/*
+ * The converged partition of a single integral: every accepted segment with its
+ * S and eps. A run with --partition=FILE starts from the partition in FILE, if
+ * there is one, accepts its segments that pass at the new tolerance at once and
+ * refines only the others. A complete run replaces FILE with its own partition.
+ * All calls do nothing until partitionOpen() succeeds.
+ */
+int partitionOpen(const char* path, double left, double right);
+void partitionRestore(struct SegmentList segList, struct Job* job, struct StatsSample* progress);
+void partitionAccept(double left, double right, double S, double eps, int nSegments);
+void partitionClose(int complete);
+
+#endif
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax() __builtin_ia32_pause()
+#else
+#define cpuRelax()
+#endif
+
+#define load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static void futexWait(unsigned* addr, unsigned val, int timeoutMs)
+{
+	struct timespec ts;
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+	errno = 0;
+}
+
+static void futexWake(unsigned* addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+	errno = 0;
+}
+
+static void ringSignal(struct Ring* ring)
+{
+	__atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+		futexWake(&ring->seq);
+}
+
+/*
+ * Values beside the entries of a ring, a row of width per slot. The int at
+ * countAt in an entry tells how many values of its row are used.
+ */
+struct RingRows
+{
+	double* slots;
+	int width;
+	size_t countAt;
+};
+
+static int rowCount(const struct RingRows* rows, const void* entry)
+{
+	int count = *(const int*)((const char*)entry + rows->countAt);
+	return count < 0 ? 0 : count > rows->width ? rows->width : count;
+}
+
+/*
+ * Pushes all n items or none of them, with the rows of their values.
+ */
+static int ringPush(struct Ring* ring, void* items, size_t size, void* item, int n, const struct RingRows* rows, const double* itemRows)
+{
+	unsigned head = ring->head;
+
+	if (head - load(&ring->tail) + n > RING_SIZE)
+		return false;
+
+	for (int i = 0; i < n; i++)
+	{
+		unsigned slot = (head + i) % RING_SIZE;
+		char* entry = (char*)item + i * size;
+
+		memcpy((char*)items + slot * size, entry, size);
+		memcpy(rows->slots + slot * rows->width, itemRows + i * rows->width, rowCount(rows, entry) * sizeof(double));
+	}
+	store(&ring->head, head + n);
+
+	return true;
+}
+
+static int ringPop(struct Ring* ring, void* items, size_t size, void* item, const struct RingRows* rows, double* itemRow)
+{
+	unsigned tail = ring->tail;
+	unsigned slot = tail % RING_SIZE;
+
+	if (load(&ring->head) == tail)
+		return false;
+
+	memcpy(item, (char*)items + slot * size, size);
+	memcpy(itemRow, rows->slots + slot * rows->width, rowCount(rows, item) * sizeof(double));
+	store(&ring->tail, tail + 1);
+
+	return true;
+}
+
+static struct RingRows knownRows(struct ShmChannel* ch)
+{
+	return (struct RingRows){ch->known[0], MAX_KNOWN, offsetof(struct CalcRequest, nKnown)};
+}
+
+static struct RingRows nodeRows(struct ShmChannel* ch)
+{
+	return (struct RingRows){ch->nodes[0], MAX_NODES, offsetof(struct ChildAnswer, nNodes)};
+}
+
+static int ringEmpty(struct Ring* ring)
+{
+	return load(&ring->head) == load(&ring->tail);
+}
+
+struct ShmRegion* shmCreate(int nChannels)
+{
+	size_t size = sizeof(struct ShmRegion) + nChannels * sizeof(struct ShmChannel);
+
+	struct ShmRegion* shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	shm->shutdown = false;
+	shm->nChannels = nChannels;
+	shm->owner = getpid();
+
+	// Spinning only pays off when the parent and every child have a CPU of their own.
+	shm->spin = get_nprocs() > nChannels ? SHM_SPIN_ITERATIONS : 0;
+
+	return shm;
+}
+
+void shmDestroy(struct ShmRegion* shm)
+{
+	munmap(shm, sizeof(struct ShmRegion) + shm->nChannels * sizeof(struct ShmChannel));
+}
+
+void shmShutdown(struct ShmRegion* shm)
+{
+	__atomic_store_n(&shm->shutdown, true, __ATOMIC_SEQ_CST);
+
+	for (int i = 0; i < shm->nChannels; i++)
+		ringSignal(&shm->channels[i].rqRing);
+}
+
+/*
+ * Empties both rings of a channel whose child is gone, for its replacement.
+ */
+void shmResetChannel(struct ShmRegion* shm, int channel)
+{
+	struct ShmChannel* ch = &shm->channels[channel];
+
+	store(&ch->rqRing.tail, load(&ch->rqRing.head));
+	store(&ch->ansRing.tail, load(&ch->ansRing.head));
+	store(&ch->rqRing.sleeping, false);
+}
+
+int shmPushRequests(struct ShmRegion* shm, int channel, struct CalcBatch* batch)
+{
+	struct ShmChannel* ch = &shm->channels[channel];
+	struct RingRows rows = knownRows(ch);
+
+	if (!ringPush(&ch->rqRing, ch->rq, sizeof(struct CalcRequest), batch->rq, batch->n, &rows, batch->known[0]))
+		return false;
+
+	ringSignal(&ch->rqRing);
+	return true;
+}
+
+static void popMoreRequests(struct ShmChannel* ch, struct CalcBatch* batch)
+{
+	struct RingRows rows = knownRows(ch);
+
+	while (batch->n < MAX_BATCH
+		&& ringPop(&ch->rqRing, ch->rq, sizeof(struct CalcRequest), &batch->rq[batch->n], &rows, batch->known[batch->n]))
+		batch->n++;
+}
+
+/*
+ * Blocks until requests arrive and takes all of them, up to MAX_BATCH. Spins first,
+ * then sleeps on the ring's futex. Returns false once the parent shuts the region
+ * down or disappears.
+ */
+int shmPopRequests(struct ShmRegion* shm, int channel, struct CalcBatch* batch)
+{
+	struct ShmChannel* ch = &shm->channels[channel];
+	struct Ring* ring = &ch->rqRing;
+
+	batch->n = 0;
+	while (true)
+	{
+		for (int i = 0; i <= shm->spin; i++)
+		{
+			popMoreRequests(ch, batch);
+			if (batch->n > 0)
+				return true;
+			if (load(&shm->shutdown))
+				return false;
+			cpuRelax();
+		}
+
+		__atomic_store_n(&ring->sleeping, true, __ATOMIC_SEQ_CST);
+		unsigned seq = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+
+		if (ringEmpty(ring) && !load(&shm->shutdown))
+			futexWait(&ring->seq, seq, SHM_WAIT_TIMEOUT_MS);
+
+		__atomic_store_n(&ring->sleeping, false, __ATOMIC_SEQ_CST);
+
+		if (getppid() != shm->owner && getpid() != shm->owner)
+			return false;
+	}
+}
+
+int shmPushAnswers(struct ShmRegion* shm, int channel, struct AnswerBatch* batch)
+{
+	struct ShmChannel* ch = &shm->channels[channel];
+	struct RingRows rows = nodeRows(ch);
+
+	if (!ringPush(&ch->ansRing, ch->ans, sizeof(struct ChildAnswer), batch->ans, batch->n, &rows, batch->nodes[0]))
+		return false;
+
+	ringSignal(&shm->doorbell);
+	return true;
+}
+
+/*
+ * Takes every answer available on the channel, up to MAX_BATCH, without blocking.
+ */
+int shmPopAnswers(struct ShmRegion* shm, int channel, struct AnswerBatch* batch)
+{
+	struct ShmChannel* ch = &shm->channels[channel];
+	struct RingRows rows = nodeRows(ch);
+
+	batch->n = 0;
+	while (batch->n < MAX_BATCH
+		&& ringPop(&ch->ansRing, ch->ans, sizeof(struct ChildAnswer), &batch->ans[batch->n], &rows, batch->nodes[batch->n]))
+		batch->n++;
+
+	return batch->n > 0;
+}
+
+int shmHasAnswer(struct ShmRegion* shm, int channel)
+{
+	return !ringEmpty(&shm->channels[channel].ansRing);
+}
+
+static int anyAnswer(struct ShmRegion* shm)
+{
+	for (int i = 0; i < shm->nChannels; i++)
+		if (shmHasAnswer(shm, i))
+			return true;
+	return false;
+}
+
+/*
+ * Waits until any channel has an answer or the timeout expires.
+ * Only sleeps in the kernel after spinning found nothing.
+ */
+int shmWaitAnswers(struct ShmRegion* shm, int timeoutMs)
+{
+	struct Ring* bell = &shm->doorbell;
+
+	for (int i = 0; i < shm->spin; i++)
+	{
+		if (anyAnswer(shm))
+			return true;
+		cpuRelax();
+	}
+
+	__atomic_store_n(&bell->sleeping, true, __ATOMIC_SEQ_CST);
+	unsigned seq = __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+
+	if (!anyAnswer(shm))
+		futexWait(&bell->seq, seq, timeoutMs);
+
+	__atomic_store_n(&bell->sleeping, false, __ATOMIC_SEQ_CST);
+
+	return anyAnswer(shm);
+}
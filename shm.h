@@ -0,0 +1,63 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <sys/types.h>
+
+#include "general.h"
+
+#define RING_SIZE (4 * MAX_BATCH)
+#define SHM_SPIN_ITERATIONS 0x4000
+#define SHM_WAIT_TIMEOUT_MS 100
+
+#define CACHE_LINE 64
+
+/*
+ * Single-producer/single-consumer ring. Producer owns head, consumer owns tail,
+ * seq is bumped on every push and is the futex word the consumer sleeps on.
+ */
+struct Ring
+{
+	unsigned head __attribute__((aligned(CACHE_LINE)));
+	unsigned tail __attribute__((aligned(CACHE_LINE)));
+	unsigned seq __attribute__((aligned(CACHE_LINE)));
+	int sleeping;
+};
+
+struct ShmChannel
+{
+	struct Ring rqRing;
+	struct Ring ansRing;
+
+	struct CalcRequest rq[RING_SIZE];
+	struct ChildAnswer ans[RING_SIZE];
+
+	// --reuse: the values of the entry in the same slot, see CalcBatch.
+	double known[RING_SIZE][MAX_KNOWN];
+	double nodes[RING_SIZE][MAX_NODES];
+};
+
+struct ShmRegion
+{
+	struct Ring doorbell;
+	int shutdown;
+	int nChannels;
+	int spin;
+	pid_t owner;
+
+	struct ShmChannel channels[];
+};
+
+struct ShmRegion* shmCreate(int nChannels);
+void shmDestroy(struct ShmRegion* shm);
+void shmShutdown(struct ShmRegion* shm);
+void shmResetChannel(struct ShmRegion* shm, int channel);
+
+int shmPushRequests(struct ShmRegion* shm, int channel, struct CalcBatch* batch);
+int shmPopRequests(struct ShmRegion* shm, int channel, struct CalcBatch* batch);
+
+int shmPushAnswers(struct ShmRegion* shm, int channel, struct AnswerBatch* batch);
+int shmPopAnswers(struct ShmRegion* shm, int channel, struct AnswerBatch* batch);
+int shmHasAnswer(struct ShmRegion* shm, int channel);
+int shmWaitAnswers(struct ShmRegion* shm, int timeoutMs);
+
+#endif
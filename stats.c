@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "ui.h"
+
+static FILE* statsOut = NULL;
+static int nStatsWorkers;
+
+static long startTime;
+static long lastReport;
+static struct StatsSample last;
+static long* busy;
+static int nLost;
+
+int statsOpen(const char* target, int nWorkers)
+{
+	if (strncmp(target, "fd:", 3) == 0)
+		statsOut = fdopen(atoi(target + 3), "w");
+	else
+		statsOut = fopen(target, "w");
+
+	if (statsOut == NULL)
+	{
+		fprintf(stderr, "Failed to open %s for statistics.\n", target);
+		return false;
+	}
+
+	busy = calloc(nWorkers, sizeof(long));
+	if (busy == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	nStatsWorkers = nWorkers;
+	startTime = nowMicros();
+	lastReport = startTime;
+	memset(&last, 0, sizeof(last));
+	nLost = 0;
+
+	return true;
+}
+
+int statsEnabled()
+{
+	return statsOut != NULL;
+}
+
+/*
+ * Adds the part of a computation that falls into the current report period.
+ * Answers arrive after the fact, so the rest has already been reported as idle.
+ */
+void statsBusy(int worker, long start, long end)
+{
+	if (statsOut == NULL)
+		return;
+
+	if (start < lastReport)
+		start = lastReport;
+	if (end > start)
+		busy[worker] += end - start;
+}
+
+/*
+ * Writes a line once every STATS_PERIOD_MS, or right away if final.
+ */
+void statsReport(struct StatsSample* sample, int final)
+{
+	if (statsOut == NULL)
+		return;
+
+	long now = nowMicros();
+	long period = now - lastReport;
+
+	if (!final && period < STATS_PERIOD_MS * 1000L)
+		return;
+	if (period <= 0)
+		period = 1;
+
+	fprintf(statsOut,
+		"{\"time\": %.3f, \"done\": %s, \"segments\": %ld, \"segments_per_second\": %.1f, "
+		"\"evaluations\": %ld, \"evaluations_per_second\": %.4g, \"free\": %d, \"in_flight\": %d, \"busy\": [",
+		(now - startTime) / 1e6, final ? "true" : "false",
+		sample->completed, (sample->completed - last.completed) * 1e6 / period,
+		sample->evaluations, (sample->evaluations - last.evaluations) * 1e6 / period,
+		sample->nFree, sample->nInFlight);
+
+	for (int i = 0; i < nStatsWorkers; i++)
+	{
+		fprintf(statsOut, "%s%.3f", i > 0 ? ", " : "", (double)busy[i] / period);
+		busy[i] = 0;
+	}
+
+	fprintf(statsOut, "], \"workers_lost\": %d, \"I\": %.17g, \"error_spent\": %.6g, \"error_budget\": %.6g, \"unresolved\": %.6g}\n",
+		nLost, sample->I, sample->errorSpent, sample->maxDeviation - sample->errorSpent, sample->width - sample->resolvedWidth);
+	fflush(statsOut);
+
+	last = *sample;
+	lastReport = now;
+}
+
+/*
+ * Writes an event line right away, between the periodic reports.
+ */
+void statsWorkerLost(int worker, int requeued, int respawned)
+{
+	if (statsOut == NULL)
+		return;
+
+	nLost++;
+	fprintf(statsOut, "{\"time\": %.3f, \"event\": \"worker_lost\", \"worker\": %d, \"requeued\": %d, \"respawned\": %s}\n",
+		(nowMicros() - startTime) / 1e6, worker, requeued, respawned ? "true" : "false");
+	fflush(statsOut);
+}
+
+void statsClose()
+{
+	if (statsOut == NULL)
+		return;
+
+	fclose(statsOut);
+	statsOut = NULL;
+	free(busy);
+}
@@ -0,0 +1,36 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "general.h"
+
+#define STATS_PERIOD_MS 500
+
+/*
+ * Progress of a run at one moment. Totals are cumulative; rates and busy
+ * fractions are computed over the time since the previous report.
+ */
+struct StatsSample
+{
+	double I;
+	double width;			// total width of the integrals
+	double maxDeviation;	// sum of their tolerances
+	double resolvedWidth;	// total width of the accepted segments
+	double errorSpent;		// sum of eps * width over the accepted segments
+	long completed;
+	long evaluations;
+	int nFree;
+	int nInFlight;
+};
+
+/*
+ * Target is a file path or "fd:N" for an inherited descriptor. Reports are
+ * single-line JSON objects. All calls do nothing until statsOpen() succeeds.
+ */
+int statsOpen(const char* target, int nWorkers);
+int statsEnabled();
+void statsBusy(int worker, long start, long end);
+void statsReport(struct StatsSample* sample, int final);
+void statsWorkerLost(int worker, int requeued, int respawned);
+void statsClose();
+
+#endif
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "steal.h"
+#include "kernel.h"
+#include "cpuconf.h"
+#include "trace.h"
+#include "stats.h"
+#include "ui.h"
+#include "sum.h"
+
+/*
+ * Decentralised engine: every worker thread owns a deque of segments, works on
+ * its front and pushes the halves of refused segments back there. A worker
+ * whose deque runs dry steals from the back of another one, where the oldest
+ * and widest segments are. The parent only waits and adds up the workers' sums.
+ */
+
+struct Interval
+{
+	double left;
+	double right;
+	int nSegments;
+};
+
+struct Deque
+{
+	pthread_mutex_t lock;
+	struct Interval* items;
+	int size;
+	int first;
+	int count;
+};
+
+struct StealPool;
+
+struct StealWorker
+{
+	struct Deque deque;
+	pthread_t thread;
+	int id;
+	struct StealPool* pool;
+
+	// Written by the worker under statsLock, read by the parent for --stats.
+	pthread_mutex_t statsLock;
+	struct StatsSample progress;
+	long busy;
+
+	// Accepted segments for compensated summation, read by the parent after the join.
+	struct Contributions accepted;
+} __attribute__((aligned(64)));
+
+struct StealPool
+{
+	struct StealWorker* workers;
+	int nWorkers;
+	double dens;
+	struct Interval root;
+
+	// Every worker allocates its own deque once pinned, so it is on the worker's node.
+	pthread_barrier_t started;
+
+	long pending;
+	enum ErrorCode error;
+};
+
+static void initDeque(struct Deque* deque)
+{
+	pthread_mutex_init(&deque->lock, NULL);
+	deque->items = malloc(DEQUE_START_SIZE * sizeof(struct Interval));
+	deque->size = DEQUE_START_SIZE;
+	deque->first = 0;
+	deque->count = 0;
+
+	if (deque->items == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for a worker deque.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void destroyDeque(struct Deque* deque)
+{
+	pthread_mutex_destroy(&deque->lock);
+	free(deque->items);
+}
+
+static void pushFront(struct Deque* deque, struct Interval seg)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count == deque->size)
+	{
+		struct Interval* items = malloc(2 * deque->size * sizeof(struct Interval));
+		if (items == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for a worker deque.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < deque->count; i++)
+			items[i] = deque->items[(deque->first + i) % deque->size];
+
+		free(deque->items);
+		deque->items = items;
+		deque->first = 0;
+		deque->size *= 2;
+	}
+
+	deque->first = (deque->first + deque->size - 1) % deque->size;
+	deque->items[deque->first] = seg;
+	deque->count++;
+
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static int popFront(struct Deque* deque, struct Interval* seg)
+{
+	int found = false;
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count > 0)
+	{
+		*seg = deque->items[deque->first];
+		deque->first = (deque->first + 1) % deque->size;
+		deque->count--;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int popBack(struct Deque* deque, struct Interval* seg)
+{
+	int found = false;
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count > 0)
+	{
+		deque->count--;
+		*seg = deque->items[(deque->first + deque->count) % deque->size];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int steal(struct StealPool* pool, int thief, struct Interval* seg)
+{
+	for (int i = 1; i < pool->nWorkers; i++)
+		if (popBack(&pool->workers[(thief + i) % pool->nWorkers].deque, seg))
+			return true;
+
+	return false;
+}
+
+static void* stealWorker(void* arg)
+{
+	struct StealWorker* self = arg;
+	struct StealPool* pool = self->pool;
+	struct timespec idle = {0, STEAL_IDLE_NS};
+	long idleSince = nowMicros();
+	struct Interval seg;
+	double S, eps;
+	long evaluations;
+	enum ErrorCode error;
+
+	attachChildToCPU(self->id);
+	initDeque(&self->deque);
+	if (self->id == 0)
+		pushFront(&self->deque, pool->root);
+	pthread_barrier_wait(&pool->started);
+
+	while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0
+		&& __atomic_load_n(&pool->error, __ATOMIC_ACQUIRE) == ERR_NO_ERROR)
+	{
+		if (!popFront(&self->deque, &seg) && !steal(pool, self->id, &seg))
+		{
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		long started = nowMicros();
+		traceIdle(self->id, idleSince, started);
+
+		calcSums(seg.left, seg.right, seg.nSegments, &S, &eps, &evaluations, &error);
+
+		idleSince = nowMicros();
+		traceCompute(self->id, started, idleSince);
+
+		if (error != ERR_NO_ERROR)
+		{
+			enum ErrorCode none = ERR_NO_ERROR;
+			__atomic_compare_exchange_n(&pool->error, &none, error, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+			break;
+		}
+
+		pthread_mutex_lock(&self->statsLock);
+		self->progress.evaluations += evaluations;
+		self->busy += idleSince - started;
+		if (eps < pool->dens)
+		{
+			self->progress.I += S;
+			if (compensatedSummation())
+				contributionsAdd(&self->accepted, &seg.left, 1, S);
+			self->progress.resolvedWidth += seg.right - seg.left;
+			self->progress.errorSpent += eps * (seg.right - seg.left);
+			self->progress.completed++;
+		}
+		pthread_mutex_unlock(&self->statsLock);
+
+		if (eps < pool->dens)
+			__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+		else
+		{
+			double center = (seg.left + seg.right) / 2;
+			int nSegments = chooseSegments(seg.nSegments, eps, pool->dens);
+
+			__atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+			pushFront(&self->deque, (struct Interval){center, seg.right, nSegments});
+			pushFront(&self->deque, (struct Interval){seg.left, center, nSegments});
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Adds up the workers' progress. Segments in the deques are free, the
+ * rest of the pending ones are being computed.
+ */
+static void collectProgress(struct StealPool* pool, struct StatsSample* total, long* busy)
+{
+	memset(total, 0, sizeof(*total));
+
+	for (int i = 0; i < pool->nWorkers; i++)
+	{
+		struct StealWorker* worker = &pool->workers[i];
+
+		pthread_mutex_lock(&worker->statsLock);
+		total->I += worker->progress.I;
+		total->resolvedWidth += worker->progress.resolvedWidth;
+		total->errorSpent += worker->progress.errorSpent;
+		total->completed += worker->progress.completed;
+		total->evaluations += worker->progress.evaluations;
+		if (busy != NULL)
+			busy[i] = worker->busy;
+		pthread_mutex_unlock(&worker->statsLock);
+
+		pthread_mutex_lock(&worker->deque.lock);
+		total->nFree += worker->deque.count;
+		pthread_mutex_unlock(&worker->deque.lock);
+	}
+
+	total->nInFlight = __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) - total->nFree;
+}
+
+/*
+ * Polls the workers until they are done; statsReport() keeps to STATS_PERIOD_MS.
+ * A worker records a segment before it stops counting as pending, so the last
+ * report is complete.
+ */
+static void reportProgress(struct StealPool* pool, double width, double maxDeviation)
+{
+	struct timespec poll = {0, STEAL_POLL_NS};
+	struct StatsSample progress;
+	long* busy = calloc(pool->nWorkers, sizeof(long));
+	long* reported = calloc(pool->nWorkers, sizeof(long));
+
+	if (busy == NULL || reported == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int done = false;
+
+	while (!done)
+	{
+		nanosleep(&poll, NULL);
+		done = __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0
+			|| __atomic_load_n(&pool->error, __ATOMIC_ACQUIRE) != ERR_NO_ERROR;
+
+		collectProgress(pool, &progress, busy);
+		progress.width = width;
+		progress.maxDeviation = maxDeviation;
+
+		long now = nowMicros();
+		for (int i = 0; i < pool->nWorkers; i++)
+		{
+			statsBusy(i, now - (busy[i] - reported[i]), now);
+			reported[i] = busy[i];
+		}
+
+		statsReport(&progress, done);
+	}
+
+	free(busy);
+	free(reported);
+}
+
+double stealIntegrate(int nWorkers, double left, double right, double maxDeviation, long* evaluations, enum ErrorCode* error)
+{
+	struct StealPool pool;
+	struct StatsSample progress;
+
+	initCPUData();
+
+	pool.nWorkers = nWorkers;
+	pool.dens = maxDeviation / (right - left);
+	pool.root = (struct Interval){left, right, N_SEGMENTS};
+	pool.pending = 1;
+	pool.error = ERR_NO_ERROR;
+	pool.workers = aligned_alloc(64, nWorkers * sizeof(struct StealWorker));
+	if (pool.workers == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nWorkers; i++)
+	{
+		memset(&pool.workers[i], 0, sizeof(struct StealWorker));
+		pthread_mutex_init(&pool.workers[i].statsLock, NULL);
+		pool.workers[i].id = i;
+		pool.workers[i].pool = &pool;
+	}
+
+	pthread_barrier_init(&pool.started, NULL, nWorkers + 1);
+
+	for (int i = 0; i < nWorkers; i++)
+		if (pthread_create(&pool.workers[i].thread, NULL, stealWorker, &pool.workers[i]) != 0)
+		{
+			fprintf(stderr, "Failed to create new thread.\n");
+			exit(EXIT_FAILURE);
+		}
+
+	pthread_barrier_wait(&pool.started);
+
+	if (statsEnabled())
+		reportProgress(&pool, right - left, maxDeviation);
+
+	for (int i = 0; i < nWorkers; i++)
+		pthread_join(pool.workers[i].thread, NULL);
+
+	collectProgress(&pool, &progress, NULL);
+
+	if (compensatedSummation())
+	{
+		struct Contributions accepted = {NULL, 0, 0, 0};
+
+		for (int i = 0; i < nWorkers; i++)
+			contributionsAppend(&accepted, &pool.workers[i].accepted);
+		progress.I = contributionsSum(&accepted);
+		contributionsFree(&accepted);
+	}
+
+	for (int i = 0; i < nWorkers; i++)
+	{
+		contributionsFree(&pool.workers[i].accepted);
+		destroyDeque(&pool.workers[i].deque);
+		pthread_mutex_destroy(&pool.workers[i].statsLock);
+	}
+	pthread_barrier_destroy(&pool.started);
+
+	*evaluations = progress.evaluations;
+	*error = pool.error;
+
+	free(pool.workers);
+	destroyCPUData();
+
+	return progress.I;
+}
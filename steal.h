@@ -0,0 +1,12 @@
+#ifndef STEAL_H
+#define STEAL_H
+
+#include "general.h"
+
+#define DEQUE_START_SIZE 0x40
+#define STEAL_IDLE_NS 50000
+#define STEAL_POLL_NS 1000000
+
+double stealIntegrate(int nWorkers, double left, double right, double maxDeviation, long* evaluations, enum ErrorCode* error);
+
+#endif
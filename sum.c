@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sum.h"
+
+static int compensated = false;
+
+void selectSummation(enum Summation summation)
+{
+	compensated = summation == SUM_NEUMAIER;
+}
+
+int compensatedSummation()
+{
+	return compensated;
+}
+
+void contributionsAdd(struct Contributions* list, const double* corner, int dim, double S)
+{
+	if (list->n == 0)
+		list->dim = dim;
+
+	if (list->n == list->size)
+	{
+		long size = list->size > 0 ? 2 * list->size : CONTRIBUTIONS_START_SIZE;
+		double* items = realloc(list->items, size * (dim + 1) * sizeof(double));
+
+		if (items == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for the accepted segments.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		list->items = items;
+		list->size = size;
+	}
+
+	double* item = list->items + list->n++ * (dim + 1);
+	memcpy(item, corner, dim * sizeof(double));
+	item[dim] = S;
+}
+
+void contributionsAppend(struct Contributions* list, struct Contributions* other)
+{
+	for (long i = 0; i < other->n; i++)
+	{
+		const double* item = other->items + i * (other->dim + 1);
+		contributionsAdd(list, item, other->dim, item[other->dim]);
+	}
+}
+
+// Two accepted boxes never share their lower corner, so the order is total.
+static int byCorner(const void* a, const void* b, void* dim)
+{
+	const double* l = a;
+	const double* r = b;
+
+	for (int i = 0; i < *(const int*)dim; i++)
+		if (l[i] != r[i])
+			return (l[i] > r[i]) - (l[i] < r[i]);
+
+	return 0;
+}
+
+double contributionsSum(struct Contributions* list)
+{
+	struct CompensatedSum total = {0, 0};
+	int dim = list->dim;
+
+	if (list->n > 0)
+		qsort_r(list->items, list->n, (dim + 1) * sizeof(double), byCorner, &dim);
+	for (long i = 0; i < list->n; i++)
+		sumAdd(&total, list->items[i * (dim + 1) + dim]);
+
+	return sumValue(total);
+}
+
+void contributionsFree(struct Contributions* list)
+{
+	free(list->items);
+	list->items = NULL;
+	list->n = 0;
+	list->size = 0;
+}
@@ -0,0 +1,102 @@
+#ifndef SUM_H
+#define SUM_H
+
+#include <math.h>
+
+#include "general.h"
+
+#define CONTRIBUTIONS_START_SIZE 0x400
+
+/*
+ * Neumaier's variant of Kahan summation: c collects the low-order bits that
+ * sum loses on every addition, also when the new term is the larger one.
+ */
+struct CompensatedSum
+{
+	double sum;
+	double c;
+};
+
+static inline void sumAdd(struct CompensatedSum* s, double x)
+{
+	double t = s->sum + x;
+
+	if (fabs(s->sum) >= fabs(x))
+		s->c += (s->sum - t) + x;
+	else
+		s->c += (x - t) + s->sum;
+	s->sum = t;
+}
+
+static inline double sumValue(struct CompensatedSum s)
+{
+	return s.sum + s.c;
+}
+
+/*
+ * Double-double numbers: hi + lo, with lo below half an ulp of hi. twoSum() and
+ * twoProduct() give the exact result of one operation as such a pair; the
+ * product splits its factors after Dekker, so it needs no fused multiply-add.
+ */
+struct DoubleDouble
+{
+	double hi;
+	double lo;
+};
+
+#define DEKKER_SPLITTER 134217729.0		// 2^27 + 1
+
+static inline struct DoubleDouble twoSum(double a, double b)
+{
+	double s = a + b;
+	double bb = s - a;
+
+	return (struct DoubleDouble){s, (a - (s - bb)) + (b - bb)};
+}
+
+static inline struct DoubleDouble twoProduct(double a, double b)
+{
+	double p = a * b;
+	double ca = DEKKER_SPLITTER * a, cb = DEKKER_SPLITTER * b;
+	double ah = ca - (ca - a), bh = cb - (cb - b);
+	double al = a - ah, bl = b - bh;
+
+	return (struct DoubleDouble){p, ((ah * bh - p) + ah * bl + al * bh) + al * bl};
+}
+
+static inline void ddAdd(struct DoubleDouble* sum, struct DoubleDouble x)
+{
+	struct DoubleDouble s = twoSum(sum->hi, x.hi);
+
+	s.lo += sum->lo + x.lo;
+	sum->hi = s.hi + s.lo;
+	sum->lo = s.lo - (sum->hi - s.hi);
+}
+
+/*
+ * Accepted segments or boxes of one integral. They are added up in the
+ * lexicographic order of their lower corners once all are in, so the result
+ * does not depend on the order in which the workers report them. Every item
+ * is the dim coordinates of the corner followed by S, so that a 1-D integral
+ * keeps only left and S; dim is set by the first item.
+ */
+struct Contributions
+{
+	double* items;
+	int dim;
+	long n;
+	long size;
+};
+
+/*
+ * Must run before the children are created so that they inherit the choice.
+ */
+void selectSummation(enum Summation summation);
+int compensatedSummation();
+
+void contributionsAdd(struct Contributions* list, const double* corner, int dim, double S);
+void contributionsAppend(struct Contributions* list, struct Contributions* other);
+double contributionsSum(struct Contributions* list);
+void contributionsFree(struct Contributions* list);
+
+#endif
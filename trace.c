@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "ui.h"
+
+struct TraceEvent
+{
+	const char* name;
+	char phase;		// 'X' span, 'b'/'e' begin and end of an async transfer
+	long ts;
+	long dur;
+	long id;
+};
+
+struct TraceTrack
+{
+	struct TraceEvent* events;
+	int nEvents;
+	int size;
+
+	long lastEnd;
+	long busy;
+	long idle;
+};
+
+static struct TraceTrack* tracks = NULL;
+static int nTracks = 0;
+static const char* tracePath = NULL;
+static long origin;
+static long nextId = 0;
+
+void traceInit(const char* path, int nWorkers)
+{
+	tracks = calloc(nWorkers + 1, sizeof(struct TraceTrack));
+	if (tracks == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory for the trace.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	nTracks = nWorkers + 1;
+	tracePath = path;
+	origin = nowMicros();
+}
+
+static void addEvent(int track, const char* name, char phase, long ts, long dur, long id)
+{
+	struct TraceTrack* t = &tracks[track];
+
+	if (t->nEvents == t->size)
+	{
+		int size = t->size > 0 ? 2 * t->size : TRACE_START_EVENTS;
+		struct TraceEvent* events = realloc(t->events, size * sizeof(struct TraceEvent));
+		if (events == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory for the trace.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		t->events = events;
+		t->size = size;
+	}
+
+	t->events[t->nEvents++] = (struct TraceEvent){name, phase, ts - origin, dur, id};
+}
+
+void traceSpan(int track, const char* name, long start, long end)
+{
+	if (tracks == NULL)
+		return;
+
+	addEvent(track, name, 'X', start, end - start, 0);
+}
+
+void traceIdle(int worker, long start, long end)
+{
+	if (tracks == NULL || end <= start)
+		return;
+
+	traceSpan(worker + 1, "idle", start, end);
+	tracks[worker + 1].idle += end - start;
+}
+
+void traceCompute(int worker, long start, long end)
+{
+	if (tracks == NULL)
+		return;
+
+	traceSpan(worker + 1, "compute", start, end);
+	tracks[worker + 1].busy += end - start;
+}
+
+/*
+ * Records the life of one request: its way to the child, the computation, and
+ * the way back until the parent read the answer. The gap since the previous
+ * computation of the worker counts as idle time.
+ */
+void traceAnswer(int worker, struct ChildAnswer* ans, long collected)
+{
+	if (tracks == NULL)
+		return;
+
+	struct TraceTrack* t = &tracks[worker + 1];
+	long id = nextId++;
+
+	if (t->lastEnd != 0)
+		traceIdle(worker, t->lastEnd, ans->started);
+
+	addEvent(worker + 1, "to child", 'b', ans->sent, 0, id);
+	addEvent(worker + 1, "to child", 'e', ans->received, 0, id);
+	traceCompute(worker, ans->started, ans->sentBack);
+	addEvent(worker + 1, "to parent", 'b', ans->sentBack, 0, id);
+	addEvent(worker + 1, "to parent", 'e', collected, 0, id);
+
+	t->lastEnd = ans->sentBack;
+}
+
+static void writeEvent(FILE* out, int track, struct TraceEvent* e)
+{
+	if (e->phase == 'X')
+		fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %ld, \"dur\": %ld}",
+			e->name, track, e->ts, e->dur);
+	else
+		fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"transfer\", \"ph\": \"%c\", \"id\": %ld, \"pid\": 1, \"tid\": %d, \"ts\": %ld}",
+			e->name, e->phase, e->id, track, e->ts);
+}
+
+void traceFinish()
+{
+	if (tracks == NULL)
+		return;
+
+	FILE* out = fopen(tracePath, "w");
+	if (out == NULL)
+		fprintf(stderr, "Failed to write the trace to %s.\n", tracePath);
+	else
+	{
+		fprintf(out, "{\"traceEvents\": [\n");
+		fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"parent\"}}");
+		for (int i = 1; i < nTracks; i++)
+			fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}}", i, i - 1);
+
+		for (int i = 0; i < nTracks; i++)
+			for (int k = 0; k < tracks[i].nEvents; k++)
+				writeEvent(out, i, &tracks[i].events[k]);
+
+		fprintf(out, "\n],\n\"displayTimeUnit\": \"ms\",\n\"otherData\": {");
+		for (int i = 1; i < nTracks; i++)
+			fprintf(out, "%s\n  \"worker %d busy us\": \"%ld\", \"worker %d idle us\": \"%ld\"",
+				i > 1 ? "," : "", i - 1, tracks[i].busy, i - 1, tracks[i].idle);
+		fprintf(out, "\n}}\n");
+
+		fclose(out);
+		fprintf(stderr, "Trace written to %s\n", tracePath);
+	}
+
+	for (int i = 0; i < nTracks; i++)
+		free(tracks[i].events);
+	free(tracks);
+	tracks = NULL;
+}
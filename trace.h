@@ -0,0 +1,22 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "general.h"
+
+#define TRACE_START_EVENTS 0x400
+
+/*
+ * Timeline of a run in Chrome trace-event format (chrome://tracing, Perfetto).
+ * Track 0 is the parent, track i + 1 is worker i. Every track has one writer:
+ * the parent for its own track and for the answers of its children, or the
+ * worker thread itself in the steal engine. All calls do nothing until
+ * traceInit() is called.
+ */
+void traceInit(const char* path, int nWorkers);
+void traceSpan(int track, const char* name, long start, long end);
+void traceIdle(int worker, long start, long end);
+void traceCompute(int worker, long start, long end);
+void traceAnswer(int worker, struct ChildAnswer* ans, long collected);
+void traceFinish();
+
+#endif
@@ -2,34 +2,38 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/time.h>
+#include <time.h>
 #include <math.h>
 
 #include "ui.h"
+#include "kernel.h"
+#include "cubature.h"
 
-struct timeval start;
-struct timeval lastPrint;
+long start;
+long lastPrint;
 int firstTime = true;
 
-long getMillis(struct timeval tv)
+/*
+ * Microseconds on the monotonic clock. It is shared by all processes of the
+ * machine, so the timestamps of the children and of the parent compare directly.
+ */
+long nowMicros()
 {
-	return (tv.tv_sec % 10000) * 1000 + tv.tv_usec / 1000;
-}
-
-long getMicros(struct timeval tv)
-{
-	return (tv.tv_sec % 100) * 1000000 + tv.tv_usec;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
 }
 
 
 void initTiming(struct ChildAnswer* answers, int nChildren)
 {
-	gettimeofday(&start, NULL);
+	start = nowMicros();
 
 	for (int i = 0; i < nChildren; i++)
 	{
 		answers[i].sent = start;
 		answers[i].received = start;
+		answers[i].started = start;
 		answers[i].sentBack = start;
 	}
 }
@@ -77,6 +81,35 @@ void printAnswer(double left, double right, double maxDeviation, double I)
 	);
 }
 
+void printEvaluations(long evaluations)
+{
+	fprintf(stderr, "Function evaluations: %ld\n", evaluations);
+}
+
+/*
+ * One line per finished job of a batch: line left right maxDeviation I errorSpent status.
+ */
+void printJobResult(long id, double left, double right, double maxDeviation, double I, double errorSpent, enum ErrorCode error)
+{
+	const char* status = "ok";
+
+	if (error == ERR_BEST_FINENESS_REACHED)
+		status = "best-fineness-reached";
+	else if (error != ERR_NO_ERROR)
+		status = "failed";
+
+	printf("%ld %.17g %.17g %g %.17g %.6g %s\n", id, left, right, maxDeviation, I, errorSpent, status);
+	fflush(stdout);
+}
+
+void printPoolStats()
+{
+	long peakSegments, peakBytes;
+
+	getSegmentPoolStats(&peakSegments, &peakBytes);
+	fprintf(stderr, "Peak segments in memory: %ld (%ld bytes of pool)\n", peakSegments, peakBytes);
+}
+
 void printProgress(struct SegmentList segList, double left, double right, double I)
 //void printProgress(struct SegmentList segList, double left, double right, double I, struct ChildAnswer* answers, int nChildren)
 {
@@ -85,13 +118,12 @@ void printProgress(struct SegmentList segList, double left, double right, double
 	double x = left;
 	struct UnstudiedSegment* p = segList.head->next;
 
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
+	long now = nowMicros();
 
-	if (p != segList.head && getMillis(tv) - getMillis(lastPrint) < PRINT_PERIOD_MS)
+	if (p != segList.head && now - lastPrint < PRINT_PERIOD_MS * 1000L)
 		return;
 	else
-		lastPrint = tv;
+		lastPrint = now;
 
 	if (firstTime)
 		firstTime = false;
@@ -124,16 +156,16 @@ void printProgress(struct SegmentList segList, double left, double right, double
 
 void printTimes(struct ChildAnswer* answers, int nChildren)
 {
-	long minTime = getMicros(answers[0].sent);
-	long maxTime = getMicros(answers[0].sentBack);
+	long minTime = answers[0].sent;
+	long maxTime = answers[0].sentBack;
 
 	for (int i = 0; i < nChildren; i++)
 	{
-		if (getMicros(answers[i].sent) < minTime)
-			minTime = getMicros(answers[i].sent);
+		if (answers[i].sent < minTime)
+			minTime = answers[i].sent;
 
-		if (getMicros(answers[i].sentBack) > maxTime)
-			maxTime = getMicros(answers[i].sentBack);
+		if (answers[i].sentBack > maxTime)
+			maxTime = answers[i].sentBack;
 	}
 
 	int dots = 100;
@@ -144,10 +176,10 @@ void printTimes(struct ChildAnswer* answers, int nChildren)
 		printf(" ");
 	printf("\n");
 	
-	printf("%4ld", minTime - getMicros(start));
+	printf("%4ld", minTime - start);
 	for (int i = 8; i < dots; i++)
 		printf("-");
-	printf("%4ld\n", maxTime - getMicros(start));
+	printf("%4ld\n", maxTime - start);
 
 	for (int i = 0; i < dots + 2; i++)
 		printf(" ");
@@ -158,15 +190,15 @@ void printTimes(struct ChildAnswer* answers, int nChildren)
 		if (microsPerDot != 0)
 		{
 			int i = 0;
-			for (; startTime + i * microsPerDot < getMicros(answers[n].sent) && i < dots; i++)
+			for (; startTime + i * microsPerDot < answers[n].sent && i < dots; i++)
 				printf(" ");
 
 			printf("\033[91m");
-			for (; startTime + i * microsPerDot < getMicros(answers[n].received) && i < dots; i++)
+			for (; startTime + i * microsPerDot < answers[n].started && i < dots; i++)
 				printf("*");
 	
 			printf("\033[92m");
-			for (; startTime + i * microsPerDot < getMicros(answers[n].sentBack) && i < dots; i++)
+			for (; startTime + i * microsPerDot < answers[n].sentBack && i < dots; i++)
 				printf("*");
 	
 			for (i--; startTime + i * microsPerDot < maxTime && i < dots; i++)
@@ -177,26 +209,422 @@ void printTimes(struct ChildAnswer* answers, int nChildren)
 	}
 }
 
-void parseArgs(int argc, char* argv[], double* left, double* right, int* nChildren, double* maxDeviation)
+/*
+ * Returns the value of "--name=value" (or "" for a bare "--name"), NULL if arg is another option.
+ */
+char* optionValue(char* arg, char* name)
+{
+	size_t len = strlen(name);
+
+	if (strncmp(arg + 2, name, len) != 0)
+		return NULL;
+
+	if (arg[2 + len] == '=')
+		return arg + 2 + len + 1;
+	else if (arg[2 + len] == '\0')
+		return arg + 2 + len;
+	else
+		return NULL;
+}
+
+void parseOption(char* arg, struct Options* opts)
+{
+	char* value;
+
+	if ((value = optionValue(arg, "engine")) != NULL)
+	{
+		if (strcmp(value, "process") == 0)
+			opts->engine = ENGINE_PROCESS;
+		else if (strcmp(value, "thread") == 0)
+			opts->engine = ENGINE_THREAD;
+		else if (strcmp(value, "steal") == 0)
+			opts->engine = ENGINE_STEAL;
+		else
+			exitErrorMsg("Unknown engine. Use --engine=process, thread or steal.\n");
+	}
+	else if ((value = optionValue(arg, "transport")) != NULL)
+	{
+		if (strcmp(value, "pipe") == 0)
+			opts->transport = TR_PIPE;
+		else if (strcmp(value, "shm") == 0)
+			opts->transport = TR_SHM;
+		else
+			exitErrorMsg("Unknown transport. Use --transport=pipe or --transport=shm.\n");
+	}
+	else if ((value = optionValue(arg, "placement")) != NULL)
+	{
+		if (strcmp(value, "scatter") == 0)
+			opts->placement = PLACEMENT_SCATTER;
+		else if (strcmp(value, "compact") == 0)
+			opts->placement = PLACEMENT_COMPACT;
+		else
+			exitErrorMsg("Unknown placement. Use --placement=scatter or --placement=compact.\n");
+	}
+	else if ((value = optionValue(arg, "sum")) != NULL)
+	{
+		if (strcmp(value, "plain") == 0)
+			opts->summation = SUM_PLAIN;
+		else if (strcmp(value, "neumaier") == 0)
+			opts->summation = SUM_NEUMAIER;
+		else
+			exitErrorMsg("Unknown summation. Use --sum=plain or --sum=neumaier.\n");
+	}
+	else if ((value = optionValue(arg, "transform")) != NULL)
+	{
+		if (strcmp(value, "none") == 0)
+			opts->transform = TRANSFORM_NONE;
+		else if (strcmp(value, "tanh-sinh") == 0)
+			opts->transform = TRANSFORM_TANH_SINH;
+		else if (strcmp(value, "rational") == 0)
+			opts->transform = TRANSFORM_RATIONAL;
+		else
+			exitErrorMsg("Unknown transform. Use --transform=none, --transform=tanh-sinh or --transform=rational.\n");
+	}
+	else if ((value = optionValue(arg, "adapt")) != NULL)
+	{
+		if (strcmp(value, "local") == 0)
+			opts->adapt = ADAPT_LOCAL;
+		else if (strcmp(value, "global") == 0)
+			opts->adapt = ADAPT_GLOBAL;
+		else
+			exitErrorMsg("Unknown adaptation. Use --adapt=local or --adapt=global.\n");
+	}
+	else if ((value = optionValue(arg, "batch")) != NULL)
+	{
+		char* endptr;
+		opts->batchSize = strtol(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0' || opts->batchSize < 0 || opts->batchSize > MAX_BATCH)
+			exitErrorMsg("Batch size must be an integer from 0 (adaptive) to 32.\n");
+	}
+	else if ((value = optionValue(arg, "respawn")) != NULL)
+	{
+		char* endptr;
+		opts->respawn = strtol(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0' || opts->respawn < 0)
+			exitErrorMsg("--respawn needs the number of children that may be replaced.\n");
+	}
+	else if ((value = optionValue(arg, "function")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--function needs the path of a shared library.\n");
+		opts->function = value;
+	}
+	else if ((value = optionValue(arg, "trace")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--trace needs the path of the trace file.\n");
+		opts->trace = value;
+	}
+	else if ((value = optionValue(arg, "stats")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--stats needs a file or fd:N.\n");
+		opts->stats = value;
+	}
+	else if ((value = optionValue(arg, "jobs")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--jobs needs a file, or - for stdin.\n");
+		opts->jobs = value;
+	}
+	else if ((value = optionValue(arg, "worker")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--worker needs [HOST:]PORT to listen on.\n");
+		opts->worker = value;
+	}
+	else if ((value = optionValue(arg, "connect")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--connect needs a list of HOST:PORT.\n");
+		opts->connect = value;
+	}
+	else if ((value = optionValue(arg, "partition")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--partition needs the path of the partition file.\n");
+		opts->partition = value;
+	}
+	else if ((value = optionValue(arg, "checkpoint")) != NULL)
+	{
+		if (*value == '\0')
+			exitErrorMsg("--checkpoint needs the path of the checkpoint file.\n");
+		opts->checkpoint = value;
+	}
+	else if (strcmp(arg, "--resume") == 0)
+		opts->resume = true;
+	else if (strcmp(arg, "--reuse") == 0)
+		opts->reuse = true;
+	else if ((value = optionValue(arg, "rule")) != NULL)
+	{
+		if (strcmp(value, "trapezoid") == 0)
+			opts->rule = RULE_TRAPEZOID;
+		else if (strcmp(value, "gk15") == 0)
+			opts->rule = RULE_GK15;
+		else if (strcmp(value, "simpson") == 0)
+			opts->rule = RULE_SIMPSON;
+		else if (strcmp(value, "romberg") == 0)
+			opts->rule = RULE_ROMBERG;
+		else if (strcmp(value, "genz-malik") == 0)
+			opts->rule = RULE_GENZ_MALIK;
+		else if (strcmp(value, "gauss") == 0)
+			opts->rule = RULE_GAUSS;
+		else
+			exitErrorMsg("Unknown rule. Use --rule=trapezoid, gk15, simpson, romberg, genz-malik or gauss.\n");
+	}
+	else if ((value = optionValue(arg, "kernel")) != NULL)
+	{
+		if (strcmp(value, "auto") == 0)
+			opts->kernel = KERNEL_AUTO;
+		else if (strcmp(value, "scalar") == 0)
+			opts->kernel = KERNEL_SCALAR;
+		else if (strcmp(value, "avx2") == 0)
+			opts->kernel = KERNEL_AVX2;
+		else if (strcmp(value, "avx512") == 0)
+			opts->kernel = KERNEL_AVX512;
+		else
+			exitErrorMsg("Unknown kernel. Use --kernel=auto, scalar, avx2 or avx512.\n");
+	}
+	else
+		exitErrorMsg("Unknown option. Type './integrate' for help.\n");
+}
+
+/*
+ * Reads a bound: one number, or a point of a box as comma-separated numbers.
+ * Returns how many there were.
+ */
+static int parseBound(char* arg, double* x, const char* which)
+{
+	char* p = arg;
+	char* endptr;
+	int n = 0;
+
+	do
+	{
+		if (n == MAX_DIM)
+			exitErrorMsg("Boxes have at most 6 dimensions.\n");
+
+		x[n++] = strtod(p, &endptr);
+		if (errno != 0 || endptr == p || (*endptr != ',' && *endptr != '\0'))
+		{
+			fprintf(stderr, "Failed to convert %s argument to double.\n", which);
+			exit(EXIT_FAILURE);
+		}
+		p = endptr + 1;
+	}
+	while (*endptr == ',');
+
+	return n;
+}
+
+void parseArgs(int argc, char* argv[], double* left, double* right, struct Box* box, int* dim, int* nChildren, double* maxDeviation, struct Options* opts)
 {
+	char* args[5];
+	int nArgs = 1;
+
+	opts->engine = ENGINE_PROCESS;
+	opts->transport = TR_AUTO;
+	opts->kernel = KERNEL_AUTO;
+	opts->rule = RULE_TRAPEZOID;
+	opts->placement = PLACEMENT_SCATTER;
+	opts->summation = SUM_PLAIN;
+	opts->adapt = ADAPT_LOCAL;
+	opts->transform = TRANSFORM_NONE;
+	opts->batchSize = 0;
+	opts->respawn = 0;
+	opts->function = NULL;
+	opts->trace = NULL;
+	opts->stats = NULL;
+	opts->jobs = NULL;
+	opts->worker = NULL;
+	opts->connect = NULL;
+	opts->checkpoint = NULL;
+	opts->partition = NULL;
+	opts->resume = false;
+	opts->reuse = false;
+
+	args[0] = argv[0];
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--", 2) == 0)
+			parseOption(argv[i], opts);
+		else if (nArgs < 5)
+			args[nArgs++] = argv[i];
+		else
+			exitErrorMsg("Wrong format. Type './integrate' for help.\n");
+	}
+
 	if (argc == 1)
 		exitErrorMsg(
-"\n Usage: ./integrate <from> <to> [nChildren] [maxDeviation]\n\n"/*\
-Calculates definite integral of function 'func', specified in 'libfunction.so'.\n\
-'libfunction.so' is compiled from 'function.c'. To change the function, edit 'function.c', then run 'make'.\n\
-All parameters except <nChildren> are of type double.\n"*/
+"\n Usage: ./integrate [options] <from> <to> [nChildren] [maxDeviation]\n"\
+"        ./integrate [options] --jobs=FILE [nChildren]\n"\
+"        ./integrate [options] --worker=[HOST:]PORT\n\n"\
+" Options:\n"\
+"   --batch=N              Segments per request message, 1 to 32. 0 (default) adapts it\n"\
+"                          per child to the measured compute time and latency.\n"\
+"   --engine=process|thread|steal\n"\
+"                          Run the children as forked processes (default) or as threads\n"\
+"                          of this process, which take their requests from a ring in\n"\
+"                          memory each. 'steal' runs threads that split segments\n"\
+"                          themselves and steal work from each other; the parent only\n"\
+"                          adds up the result.\n"\
+"   --transport=pipe|shm   How requests reach the children: a pipe per child or lock-free\n"\
+"                          rings in shared memory. Processes default to pipes, threads\n"\
+"                          to the rings.\n"\
+"   --placement=scatter|compact\n"\
+"                          Where the workers are pinned. Both take one hardware thread\n"\
+"                          of every physical core before any SMT sibling; 'scatter'\n"\
+"                          (default) deals them out over the NUMA nodes in turn,\n"\
+"                          'compact' fills one node before the next.\n"\
+"   --respawn=N            A lost child's segments always go to the others; up to N\n"\
+"                          lost children are also replaced by new ones on the same CPU,\n"\
+"                          or reconnected when remote. Default 0.\n"\
+"   --kernel=auto|scalar|avx2|avx512\n"\
+"                          Summation kernel; auto picks the widest one the CPU supports.\n"\
+"   --rule=trapezoid|gk15|simpson|romberg|genz-malik|gauss\n"\
+"                          Quadrature rule applied to every segment. 'trapezoid' (default)\n"\
+"                          samples it at about a million points; 'gk15' is 15-point\n"\
+"                          Gauss-Kronrod, 'simpson' is adaptive Simpson and 'romberg'\n"\
+"                          extrapolates trapezoids over 33 points. Boxes take the degree 7\n"\
+"                          rule of Genz and Malik (default) or 'gauss', 5-point Gauss-\n"\
+"                          Legendre along every axis; refused boxes are halved along the\n"\
+"                          axis with the largest fourth difference.\n"\
+"   --sum=plain|neumaier   How the kernel adds up the samples of a segment and the parent\n"\
+"                          the accepted segments. 'neumaier' compensates the rounding\n"\
+"                          of every addition and adds the segments or boxes in the order\n"\
+"                          of their lower corners at the end, so the result does not\n"\
+"                          depend on the order or the number of the workers. Default\n"\
+"                          'plain'.\n"\
+"   --transform=none|tanh-sinh|rational\n"\
+"                          Integrate f(x(t)) x'(t) over t instead. 'tanh-sinh' crowds\n"\
+"                          the samples towards the ends of a finite interval, so that\n"\
+"                          singularities there such as 1/sqrt(x) converge; 'rational',\n"\
+"                          x = t / (1 - t) and its mirrors, maps infinite bounds such\n"\
+"                          as 'inf' and '-inf' to finite ones and is their default.\n"\
+"                          Only for a single integral computed on this host.\n"\
+"   --adapt=local|global   'local' (default) accepts every segment whose error is below\n"\
+"                          its share of the tolerance. 'global' keeps the evaluated\n"\
+"                          segments, splits the one with the largest error and stops\n"\
+"                          as soon as the sum of all errors is below the tolerance.\n"\
+"                          Not with the steal engine or checkpoints.\n"\
+"   --reuse                The halves of a segment refused by 'simpson' or 'romberg'\n"\
+"                          take the values at the nodes they share with it, so that\n"\
+"                          only the new nodes are evaluated. Not with the steal engine.\n"\
+"   --function=LIB.so      Integrate 'double func(double x)' from LIB.so instead of the\n"\
+"                          built-in f(x). An optional 'void func_v(const double* x,\n"\
+"                          double* y, size_t n)' is called once per 258 points instead.\n"\
+"                          'libfunction.so' is compiled from 'function.c' by 'make libfunction.so'.\n"\
+"                          Boxes call 'double func_nd(const double* x, int dim)'.\n"\
+"   --trace=FILE           Record when every request is sent, received, computed and\n"\
+"                          answered, the idle time of every worker and the time the\n"\
+"                          parent waits and dispatches. Written at exit as a Chrome\n"\
+"                          trace (chrome://tracing or ui.perfetto.dev).\n"\
+"   --stats=FILE|fd:N      Every 500 ms write a JSON line with segments and evaluations\n"\
+"                          per second, free and in-flight segments, the busy fraction\n"\
+"                          of every worker, the current I and the error budget left.\n"\
+"   --jobs=FILE|-          Batch mode: integrate every 'from to [maxDeviation]' line of\n"\
+"                          FILE or stdin with one pool of children, several jobs at a\n"\
+"                          time. Prints 'line from to maxDeviation I error status' as\n"\
+"                          each job completes. Jobs take finite bounds only.\n"\
+"   --worker=[HOST:]PORT   Compute for coordinators on other hosts instead: every TCP\n"\
+"                          connection gets a pinned thread of its own. Give the worker\n"\
+"                          the --rule, --sum and --function of the coordinator; it\n"\
+"                          refuses coordinators with another rule, summation or\n"\
+"                          integrand.\n"\
+"   --connect=HOST:PORT,...\n"\
+"                          Coordinator: send the segments to these workers instead of\n"\
+"                          local children, with <nChildren> connections to each.\n"\
+"   --checkpoint=FILE      Save the unfinished segments and the sum so far to FILE every\n"\
+"                          10 s and on SIGINT or SIGTERM, which also stop the run. FILE\n"\
+"                          is removed once the integral is done.\n"\
+"   --resume               Go on from the --checkpoint FILE of an earlier run with the\n"\
+"                          same <from>, <to>, <maxDeviation>, --rule, --sum and\n"\
+"                          integrand.\n"\
+"   --partition=FILE       Start from the segments that FILE holds from an earlier run of\n"\
+"                          the same <from>, <to>, --rule and integrand: those that pass\n"\
+"                          at <maxDeviation> are taken as they are, only the others are\n"\
+"                          refined. A complete run saves its own segments to FILE.\n\n"\
+" All parameters except <nChildren> are of type double. <from> and <to> of a box of\n"\
+" 2 to 6 dimensions are its corners as comma-separated lists, such as 0,0,0 1,1,1;\n"\
+" the built-in integrand of a box is the product of f over the coordinates.\n\n"
 		);
-	else if (argc < 3 || argc > 6)
+	else if (opts->worker != NULL && nArgs > 1)
+		exitErrorMsg("Worker mode takes no arguments. Type './integrate' for help.\n");
+	else if (opts->jobs != NULL && nArgs > 2)
+		exitErrorMsg("Batch mode takes only [nChildren]. Type './integrate' for help.\n");
+	else if (opts->jobs == NULL && opts->worker == NULL && nArgs < 3)
 		exitErrorMsg("Wrong format. Type './integrate' for help.\n");
+	else if (opts->resume && opts->checkpoint == NULL)
+		exitErrorMsg("--resume needs the --checkpoint to resume from.\n");
+
+	argv = args;
+	argc = nArgs;
 
 	char* endptr;
-	*left  = strtod(argv[1], &endptr);
-	if (errno != 0 || (unsigned)(endptr - argv[1]) != strlen(argv[1]))
-		exitErrorMsg("Failed to convert 1st argument to double.\n");
 
-	*right = strtod(argv[2], &endptr);
-	if (errno != 0 || (unsigned)(endptr - argv[2]) != strlen(argv[2]))
-		exitErrorMsg("Failed to convert 2nd argument to double.\n");
+	unitBox(box);
+	*dim = 1;
+
+	if (opts->worker != NULL)
+	{
+		*left = 0;
+		*right = 0;
+		*maxDeviation = 0;
+		*nChildren = 0;
+		return;
+	}
+
+	if (opts->jobs != NULL)
+	{
+		*left = 0;
+		*right = 0;
+		*maxDeviation = 0;
+		*nChildren = 1;
+
+		if (argc >= 2)
+		{
+			*nChildren = strtol(argv[1], &endptr, 10);
+			if (errno != 0 || (unsigned)(endptr - argv[1]) != strlen(argv[1]))
+				exitErrorMsg("Failed to convert nChildren to int.\n");
+		}
+		return;
+	}
+
+	double from[MAX_DIM], to[MAX_DIM];
+
+	*dim = parseBound(argv[1], from, "1st");
+	if (parseBound(argv[2], to, "2nd") != *dim)
+		exitErrorMsg("<from> and <to> must have as many coordinates.\n");
+
+	*left = from[0];
+	*right = to[0];
+	for (int i = 0; i < *dim && *dim > 1; i++)
+		if (!isfinite(from[i]) || !isfinite(to[i]))
+			exitErrorMsg("Every coordinate of a box must be finite; only 1-D integrals take infinite bounds.\n");
+	for (int i = 1; i < *dim; i++)
+	{
+		box->lower[i - 1] = from[i];
+		box->upper[i - 1] = to[i];
+		if (!(from[i] < to[i]))
+			exitErrorMsg("Every coordinate of <from> must be below the one of <to>.\n");
+	}
+
+	// Boxes take the cubature rules; the default trapezoid rule becomes Genz-Malik.
+	if (*dim > 1 && opts->rule == RULE_TRAPEZOID)
+		opts->rule = RULE_GENZ_MALIK;
+	if ((*dim > 1) != cubatureRule(opts->rule))
+		exitErrorMsg("genz-malik and gauss integrate over boxes, the other rules over intervals.\n");
+
+	// Infinite bounds are reached through the rational transform.
+	if ((isinf(*left) || isinf(*right)) && opts->transform == TRANSFORM_NONE)
+		opts->transform = TRANSFORM_RATIONAL;
+	if (opts->transform != TRANSFORM_NONE)
+	{
+		if (*dim > 1 || !(*left < *right))
+			exitErrorMsg("Transforms need a 1-D integral with <from> below <to>.\n");
+		if ((opts->transform == TRANSFORM_RATIONAL) != (isinf(*left) || isinf(*right)))
+			exitErrorMsg("The rational transform is for infinite bounds, tanh-sinh for finite ones.\n");
+	}
 
 	if (argc >= 4)
 	{
@@ -234,5 +662,8 @@ Please, try running the program again with bigger <maxDeviation>.\n\n");
 		case ERR_CHILD_DISCONNECTED:
 			fprintf(stderr, "Lost connection with one of calculating processes. Relaunching the program may help.\n");
 			break;
+		case ERR_INTERRUPTED:
+			fprintf(stderr, "Interrupted. Run the program again with the same arguments and --resume to go on.\n");
+			break;
 	}
 }
@@ -14,10 +14,13 @@ void printTimes(struct ChildAnswer* answers, int nChildren);
 void printProgress(struct SegmentList segList, double left, double right, double I);
 //void printProgress(struct SegmentList segList, double left, double right, double I, struct ChildAnswer* answers, int nChildren);
 void printAnswer(double left, double right, double maxDeviation, double I);
+void printPoolStats();
+void printEvaluations(long evaluations);
+void printJobResult(long id, double left, double right, double maxDeviation, double I, double errorSpent, enum ErrorCode error);
 
-void parseArgs(int argc, char* argv[], double* left, double* right, int* nChildren, double* maxDeviation);
+void parseArgs(int argc, char* argv[], double* left, double* right, struct Box* box, int* dim, int* nChildren, double* maxDeviation, struct Options* opts);
 
-long getMicros(struct timeval tv);
+long nowMicros();
 
 void explainError(enum ErrorCode error);
 